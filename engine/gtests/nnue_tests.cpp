@@ -0,0 +1,112 @@
+#include <ChePP/engine/movegen.h>
+#include <ChePP/engine/nnue.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+// the lazy stack has to give exactly what a full refresh gives, whichever nodes were skipped on the way
+TEST(Accumulators, LazyMatchesRefresh)
+{
+    Positions    positions{"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"};
+    Accumulators accumulators{positions.last()};
+
+    PRNG gen{1234};
+    for (int i = 0; i < 2000; i++)
+    {
+        uint64_t r;
+        gen = gen.next(r);
+
+        const MoveList moves = gen_legal(positions.last());
+        if (positions.ply() > 0 && (moves.empty() || positions.ply() >= 12 || r % 4 == 0))
+        {
+            positions.undo_move();
+            accumulators.undo_move();
+        }
+        else if (!moves.empty())
+        {
+            positions.do_move(moves[r % moves.size()].move);
+            accumulators.do_move(positions.last());
+        }
+
+        // evaluate only now and then so some nodes are never materialized
+        if (r % 3 == 0)
+        {
+            const Color stm = positions.last().side_to_move();
+            EXPECT_EQ(accumulators.last().evaluate(stm), Accumulator(positions.last()).evaluate(stm));
+        }
+    }
+}
+
+TEST(Accumulators, SparseL1MatchesDense)
+{
+    Positions positions{"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"};
+
+    PRNG gen{42};
+    for (int i = 0; i < 64; i++)
+    {
+        uint64_t r;
+        gen = gen.next(r);
+
+        const MoveList moves = gen_legal(positions.last());
+        if (moves.empty() || positions.ply() >= 40)
+            break;
+        positions.do_move(moves[r % moves.size()].move);
+
+        const Accumulator acc{positions.last()};
+        for (const auto view : {WHITE, BLACK})
+        {
+            for (size_t bucket = 0; bucket < 8; bucket++)
+            {
+                EXPECT_EQ(acc.evaluate(view, bucket), acc.evaluate_dense(view, bucket));
+            }
+        }
+    }
+}
+
+TEST(Network, LoadsVersionedFileAndRejectsBadOnes)
+{
+    const auto dir = std::filesystem::temp_directory_path();
+
+    // the embedded network written out in the versioned format
+    const auto good = dir / "chepp_test.chepp";
+    {
+        std::ofstream out(good, std::ios::binary);
+        NetworkFileHeader header{NetworkFileHeader::s_magic, NetworkFileHeader::s_version, Network::N_LAYERS};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& l : Network::table())
+        {
+            NetworkFileLayer layer{l.type, {}, l.size, {}};
+            std::ranges::copy(l.name, layer.name.begin());
+            out.write(reinterpret_cast<const char*>(&layer), sizeof(layer));
+        }
+        for (const auto& l : Network::table())
+        {
+            const std::vector<char> pad((64 - out.tellp() % 64) % 64, 0);
+            out.write(pad.data(), static_cast<std::streamsize>(pad.size()));
+            out.write(static_cast<const char*>(l.embedded),
+                      static_cast<std::streamsize>(l.size * Network::type_size(l.type)));
+        }
+    }
+    const auto bad = dir / "chepp_test_bad.chepp";
+    {
+        std::ofstream out(bad, std::ios::binary);
+        out << "definitely not a network";
+    }
+
+    Position pos;
+    pos.from_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    const int embedded = Accumulator(pos).evaluate(WHITE);
+
+    EXPECT_FALSE(g_network.load(bad.string()));
+    EXPECT_EQ(g_network.name(), "<embedded>");
+
+    ASSERT_TRUE(g_network.load(good.string()));
+    EXPECT_NE(static_cast<const void*>(g_network.ft_weights()), static_cast<const void*>(g_ft_weights));
+    EXPECT_EQ(Accumulator(pos).evaluate(WHITE), embedded);
+
+    g_network.load_embedded();
+    std::filesystem::remove(good);
+    std::filesystem::remove(bad);
+}
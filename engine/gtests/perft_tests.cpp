@@ -67,3 +67,31 @@ TEST(EngineTest, PerftCases)
         }
     }
 }
+
+inline void undo_roundtrip(Positions& positions, const int ply)
+{
+    if (ply == 0)
+        return;
+
+    const std::string fen  = positions.last().to_fen();
+    const hash_t      hash = positions.last().hash();
+    for (const auto [move, score] : gen_legal(positions.last()))
+    {
+        positions.do_move(move);
+        undo_roundtrip(positions, ply - 1);
+        positions.undo_move();
+        ASSERT_EQ(positions.last().to_fen(), fen) << "after " << move;
+        ASSERT_EQ(positions.last().hash(), hash) << "after " << move;
+    }
+}
+
+// undo_move has to put back exactly what do_move changed, castling, en passant and promotions included
+TEST(EngineTest, UndoRestoresPosition)
+{
+    for (const char* fen : {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                            "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1"})
+    {
+        Positions positions{fen};
+        undo_roundtrip(positions, 3);
+    }
+}
@@ -36,6 +36,23 @@ TEST(ThreeFoldRepetitions, TwoNightShuffleIsDraw)
     ASSERT_EQ(positions.is_repetition(), true);
 }
 
+TEST(ThreeFoldRepetitions, HasRepeatedAfterOneCycle)
+{
+
+    Positions positions{"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"};
+    positions.do_move(Move::make<NORMAL>(G1, F3));
+    positions.do_move(Move::make<NORMAL>(G8, F6));
+    positions.do_move(Move::make<NORMAL>(F3, G1));
+    ASSERT_EQ(positions.has_repeated(), false);
+    positions.do_move(Move::make<NORMAL>(F6, G8));
+    ASSERT_EQ(positions.has_repeated(), true);
+    ASSERT_EQ(positions.is_repetition(), false);
+
+    // a zeroing move leaves the repetition behind
+    positions.do_move(Move::make<NORMAL>(E2, E4));
+    ASSERT_EQ(positions.has_repeated(), false);
+}
+
 TEST(FiftyMoveRule, FiftyRookShuffleIsDraw)
 {
     Positions positions("K1k5/pppppppp/8/8/8/8/8/R7 w KQkq - 0 1");
@@ -0,0 +1,50 @@
+#include <ChePP/engine/movegen.h>
+#include <gtest/gtest.h>
+
+#include <array>
+
+TEST(See, KnownExchanges)
+{
+    Position pos;
+
+    // pawn defended by a pawn, rook takes and is taken back
+    pos.from_fen("1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - - 0 1");
+    EXPECT_EQ(pos.see(Move::make<NORMAL>(E1, E5)), 100);
+
+    pos.from_fen("1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1");
+    EXPECT_EQ(pos.see(Move::make<NORMAL>(D3, E5)), -200);
+}
+
+// the threshold and batched versions have to agree with the full exchange everywhere
+TEST(See, ThresholdAndBatchMatchFullExchange)
+{
+    Positions positions{"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"};
+
+    PRNG gen{7};
+    for (int i = 0; i < 300; i++)
+    {
+        uint64_t r;
+        gen = gen.next(r);
+
+        const Position& pos = positions.last();
+        MoveList        captures;
+        gen_moves<CAPTURES>(pos, captures);
+        captures.filter([&](const ScoredMove& mv) { return mv.move.type_of() != PROMOTION; });
+
+        std::array<int, MoveList::max_moves> batch;
+        see_all(pos, captures, batch);
+        for (size_t j = 0; j < captures.size(); j++)
+        {
+            const Move m   = captures[j].move;
+            const int  see = pos.see(m);
+            EXPECT_EQ(batch[j], see);
+            for (const int t : {see - 1, see, see + 1, -500, 0, 100})
+                EXPECT_EQ(pos.see_ge(m, t), see >= t);
+        }
+
+        const MoveList moves = gen_legal(pos);
+        if (moves.empty() || positions.ply() >= 30)
+            break;
+        positions.do_move(moves[r % moves.size()].move);
+    }
+}
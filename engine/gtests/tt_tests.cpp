@@ -0,0 +1,115 @@
+#include <ChePP/engine/position.h>
+#include <ChePP/engine/tt.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(TranspositionTable, StoreThenProbe)
+{
+    tt_t tt;
+    tt.init(1);
+
+    const hash_t hash = 0x123456789abcdef0ULL;
+    const Move   move = Move::make<NORMAL>(E2, E4);
+
+    EXPECT_FALSE(tt.probe(hash));
+
+    tt.store(hash, 7, 42, 13, LOWER, move);
+    const auto hit = tt.probe(hash);
+
+    ASSERT_TRUE(hit);
+    EXPECT_EQ(hit->m_depth, 7);
+    EXPECT_EQ(hit->m_score, 42);
+    EXPECT_EQ(hit->m_eval, 13);
+    EXPECT_EQ(hit->m_bound, LOWER);
+    EXPECT_EQ(hit->m_move, move);
+}
+
+TEST(TranspositionTable, BucketKeepsDeepEntries)
+{
+    tt_t tt;
+    tt.init(1);
+
+    const Move move = Move::make<NORMAL>(G1, F3);
+
+    // same bucket index, different keys
+    auto colliding = [](const int i) { return (static_cast<hash_t>(i + 1) << 48) | 0x42; };
+
+    tt.store(colliding(0), 20, 1, 0, EXACT, move);
+    for (int i = 1; i < 32; i++)
+    {
+        tt.store(colliding(i), 1, 1, 0, EXACT, move);
+    }
+
+    EXPECT_TRUE(tt.probe(colliding(0)));
+    EXPECT_TRUE(tt.probe(colliding(31)));
+}
+
+// only 16 bits of the hash are checked, a position sharing the index and the key gets the entry of another one.
+// Its move is then usually not even playable, the search has to check it before trusting the entry
+TEST(TranspositionTable, CollidingKeyIsCaughtByMoveCheck)
+{
+    tt_t tt;
+    tt.init(1);
+
+    Position stored, probing;
+    stored.from_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    probing.from_fen("rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2");
+
+    const Move move = Move::make<NORMAL>(G1, F3);
+    ASSERT_TRUE(stored.is_pseudo_legal(move));
+
+    // same index and key bits, the bits in between differ
+    const hash_t hash      = 0xABCD'0000'0000'0042ULL;
+    const hash_t colliding = hash | 0x0000'1234'5600'0000ULL;
+
+    tt.store(hash, 10, 0, 0, EXACT, move);
+    const auto hit = tt.probe(colliding);
+
+    ASSERT_TRUE(hit);
+    EXPECT_EQ(hit->m_move, move);
+    EXPECT_FALSE(probing.is_pseudo_legal(hit->m_move));
+}
+
+TEST(TranspositionTable, ConcurrentAccessNeverReturnsTornEntries)
+{
+    tt_t tt;
+    tt.init(1);
+
+    // every writer stores a payload derived from the hash, so any hit must decode back to it
+    auto score_of = [](const hash_t h) { return static_cast<int>(h % 2000) - 1000; };
+    auto move_of  = [](const hash_t h) { return Move{static_cast<uint16_t>((h >> 20) % 4000 + 1)}; };
+
+    std::atomic<int>         mismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back(
+            [&, t]()
+            {
+                PRNG gen{static_cast<uint64_t>(t + 1)};
+                for (int i = 0; i < 200'000; i++)
+                {
+                    uint64_t r;
+                    gen = gen.next(r);
+                    // few distinct keys per bucket so writers keep colliding
+                    const hash_t h = (r & 0xFFFF'0000'0000'000FULL);
+                    if (i & 1)
+                    {
+                        tt.store(h, static_cast<int>(r % 20), score_of(h), 0, EXACT, move_of(h));
+                    }
+                    else if (const auto hit = tt.probe(h);
+                             hit && (hit->m_score != score_of(h) || hit->m_move != move_of(h)))
+                    {
+                        ++mismatches;
+                    }
+                }
+            });
+    }
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_EQ(mismatches.load(), 0);
+}
@@ -48,3 +48,47 @@ TEST(ZobristTranspositions, CastlingRightsAffectHash) {
 }
 
 
+// key_after and is_repetition_after have to agree with actually playing the move, on every kind of move
+TEST(ZobristTranspositions, KeyAfterMatchesDoMove) {
+    for (const auto fen : {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                           "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1", "8/2k5/8/8/3N4/8/2K5/8 w - - 90 1"})
+    {
+        Positions positions{fen};
+        PRNG      gen{7};
+        for (int i = 0; i < 300; i++)
+        {
+            uint64_t r;
+            gen = gen.next(r);
+
+            const MoveList moves = gen_legal(positions.last());
+            if (moves.empty() || positions.ply() >= 60)
+                break;
+
+            for (const auto& [m, _] : moves)
+            {
+                const hash_t key       = positions.last().key_after(m);
+                const bool   repeating = positions.is_repetition_after(m);
+                positions.do_move(m);
+                EXPECT_EQ(key, positions.last().hash()) << m.to_string() << " in " << fen;
+                EXPECT_EQ(repeating, positions.is_repetition());
+                positions.undo_move();
+            }
+            positions.do_move(moves[r % moves.size()].move);
+        }
+    }
+}
+
+// moves out of a colliding TT entry don't belong to the position, computing their key must not blow up
+TEST(ZobristTranspositions, KeyAfterForeignMoves) {
+    Positions positions{"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"};
+    const Position& pos = positions.last();
+
+    const Move from_empty = Move::make<NORMAL>(E4, E5);
+    EXPECT_NO_THROW((void)pos.key_after(from_empty));
+    EXPECT_NO_THROW((void)positions.is_repetition_after(from_empty));
+    EXPECT_EQ(pos.key_after(from_empty), pos.key_after(Move::null()));
+
+    const Move theirs = Move::make<NORMAL>(G8, F6);
+    EXPECT_NO_THROW((void)pos.key_after(theirs));
+    EXPECT_NO_THROW((void)positions.is_repetition_after(theirs));
+}
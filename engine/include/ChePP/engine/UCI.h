@@ -11,6 +11,7 @@
 #include "tb.h"
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -248,7 +249,9 @@ class UCIEngine {
     {
         int hash_size{};
         int threads{};
+        int multipv{};
         std::string tb_path{};
+        std::string eval_file{};
         EngineParameters handler{};
     };
 
@@ -261,7 +264,8 @@ class UCIEngine {
 
 
     Parameters m_params{};
-    State m_state{Waiting};
+    // written by the worker when its search ends while the UCI thread reads it
+    std::atomic<State> m_state{Waiting};
     Pos m_pos{};
     std::jthread m_worker;
     SearchThreadHandler m_handler{};
@@ -269,23 +273,52 @@ class UCIEngine {
 
 public:
     UCIEngine() {
-        m_params.handler.add<EngineParamSpin>("Hash Size", m_params.hash_size, 64, 64, 512);
+        m_params.handler.add<EngineParamSpin>("Hash Size", m_params.hash_size, 512, 1, 1 << 17, [this]()
+        {
+            if (m_state != Waiting) return false;
+            g_tt.init(m_params.hash_size, m_params.threads);
+            std::cout << "info string Hash resized to " << g_tt.size_mb() << " MB" << std::endl;
+            return true;
+        });
         m_params.handler.add<EngineParamSpin>("Threads", m_params.threads, 1, 1, std::thread::hardware_concurrency());
+        m_params.handler.add<EngineParamSpin>("MultiPV", m_params.multipv, 1, 1, 256);
         m_params.handler.add<EngineParamString>("SyzygyPath", m_params.tb_path, "", [this] ()
         {
+            if (m_state != Waiting) return false;
             bool val = init_tb(m_params.tb_path);
             if (val) std::cout << "info string set tb path" << std::endl;
             return val;
 
         });
+        m_params.handler.add<EngineParamSpin>("SyzygyProbeDepth", g_tb_params.probe_depth, 1, 1, 100);
+        m_params.handler.add<EngineParamSpin>("SyzygyProbeLimit", g_tb_params.probe_limit, 7, 0, 7);
+
+        m_params.handler.add<EngineParamString>("EvalFile", m_params.eval_file, "<embedded>", [this]()
+        {
+            if (m_state != Waiting) return false;
+            if (m_params.eval_file.empty() || m_params.eval_file == "<embedded>")
+                g_network.load_embedded();
+            else if (!g_network.load(m_params.eval_file))
+            {
+                m_params.eval_file = g_network.name();
+                return false;
+            }
+            // the TT keeps the evals of the previous network
+            g_tt.reset(m_params.threads);
+            std::cout << "info string Using network " << g_network.name() << std::endl;
+            return true;
+        });
 
-        m_params.handler.add<EngineParamButton>("Clear Hash", []() {
-            g_tt.reset();
+        m_params.handler.add<EngineParamButton>("Clear Hash", [this]() {
+            if (m_state != Waiting) return false;
+            g_tt.reset(m_params.threads);
             std::cout << "info string Hash cleared" << std::endl;
             return true;
         });
         m_pos.init_pos.from_fen(start_fen);
         m_pos.last_pos.from_fen(start_fen);
+
+        g_tt.init(m_params.hash_size, m_params.threads);
     }
 
     void uci() const
@@ -297,14 +330,15 @@ public:
         std::cout << "uciok" << std::endl;
     }
 
+    // answered at any time, a GUI may ask while an infinite or ponder search runs
     void isready() const {
-        if (m_state != Waiting) return;
         std::cout << "readyok" << std::endl ;
     }
 
     void ucinewgame() {
         if (m_state != Waiting) return;
-        g_tt.reset();
+        g_tt.reset(m_params.threads);
+        m_handler.clear();
     }
 
     void position(const std::string& cmd) {
@@ -381,6 +415,9 @@ public:
             else if (token == "movestogo") iss >> constraints.moves_to_go;
             else if (token == "depth") { iss >> constraints.depth; ; }
             else if (token == "movetime") { iss >> constraints.move_time; }
+            else if (token == "nodes") iss >> constraints.nodes;
+            else if (token == "infinite") constraints.infinite = true;
+            else if (token == "ponder") constraints.ponder = true;
 
         }
 
@@ -391,14 +428,24 @@ public:
 
         TimeManager tm{ tm_params, init_info, constraints };
 
-        m_handler.set(m_params.threads, tm, m_pos.init_pos, m_pos.moves);
+        m_handler.set(m_params.threads, tm, m_pos.init_pos, m_pos.moves, m_params.multipv);
+
+        // set before the worker exists, a search that ends right away must not be left looking busy
+        m_state = constraints.ponder ? Pondering : Searching;
         m_worker = std::jthread([&]()
         {
             m_handler.start();
-            m_state = Waiting;
+            m_state.store(Waiting);
         });
+    }
 
-        m_state = Searching;
+    // the opponent played the move we were pondering on, the running search goes on with the real clock
+    void ponderhit()
+    {
+        // the search may end between a check and a store, it must not be left looking busy
+        State pondering = Pondering;
+        if (!m_state.compare_exchange_strong(pondering, Searching)) return;
+        m_handler.ponderhit();
     }
 
     void eval() const
@@ -435,6 +482,8 @@ public:
                 eval();
             } else if (line == "stop") {
                 stop();
+            } else if (line == "ponderhit") {
+                ponderhit();
             } else if (line == "quit") {
                 stop();
                 break;
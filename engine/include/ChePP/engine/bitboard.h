@@ -4,9 +4,17 @@
 #include <array>
 #include <cassert>
 #include <cstdlib>
-#include <random>
 #include <string>
 
+// Slider lookups index the attack tables with pext when the target has BMI2, and with the fixed magics below
+// otherwise. Zen 1/2 have BMI2 but a microcoded pext, build those with CHEPP_NO_PEXT (cmake -DUSE_PEXT=OFF).
+#if defined(__BMI2__) && !defined(CHEPP_NO_PEXT)
+#define CHEPP_USE_PEXT 1
+#include <immintrin.h>
+#else
+#define CHEPP_USE_PEXT 0
+#endif
+
 class Bitboard
 {
   public:
@@ -339,6 +347,45 @@ constexpr Bitboard relevancy_mask(const Square sq)
     return ray<pc>(sq) & mask;
 }
 
+// Fixed magics for the multiply-shift lookup, found offline by scripts/find_magics.cpp.
+// Indexed by square, the shift is always 64 - popcount(relevancy mask).
+inline constexpr std::array<Bitboard::U64, 64> g_bishop_magics{
+    0x2002081204040420ULL, 0x08200400C2044002ULL, 0x82220801042A0088ULL, 0x00908902000C0051ULL,
+    0x400C504080003000ULL, 0x0121010940040100ULL, 0x0201010121A00010ULL, 0x00810080900130ACULL,
+    0x0910080204040408ULL, 0x001090010801004AULL, 0x401C1034004C4404ULL, 0x0000082080201004ULL,
+    0x8300840308020001ULL, 0x3500624110400000ULL, 0x8582020104424020ULL, 0x430C010080A42000ULL,
+    0x0410022802982802ULL, 0x0021006488108109ULL, 0x000100C204040580ULL, 0x0918100402102000ULL,
+    0x0408200402080010ULL, 0x40A0800100600200ULL, 0x0000842200842000ULL, 0x4026000488510800ULL,
+    0x0420900248024891ULL, 0xCA04220020084100ULL, 0x0080241002080200ULL, 0x8100802258020020ULL,
+    0x0400840122802001ULL, 0x0010030410804900ULL, 0x0001240821040108ULL, 0x88810200010080A0ULL,
+    0x0104500800042002ULL, 0x0004100480020424ULL, 0x0086020202010804ULL, 0x0006110800A40040ULL,
+    0x2022008400020020ULL, 0x1881020082080801ULL, 0x0008022080040889ULL, 0x0801020610582903ULL,
+    0x09431012E1421008ULL, 0x88820104A0050220ULL, 0x4001410401004084ULL, 0x0000802024200800ULL,
+    0x8020102051400201ULL, 0x0001200081001080ULL, 0x0010410204090088ULL, 0x0010022880208111ULL,
+    0x0042480829280000ULL, 0x01B4884808048428ULL, 0x2141010908092000ULL, 0x2000800104880480ULL,
+    0x0108001020222001ULL, 0x1806400204810000ULL, 0x10403501022A0080ULL, 0x0010020808508490ULL,
+    0x2B00402208024000ULL, 0x6000202E02301404ULL, 0x0288048042009020ULL, 0x0000008030420202ULL,
+    0x1400018110820200ULL, 0x0004208802480200ULL, 0x0002900202180209ULL, 0x2020041002042128ULL,
+};
+inline constexpr std::array<Bitboard::U64, 64> g_rook_magics{
+    0x4180004000228010ULL, 0x8140002000411000ULL, 0x0100100820004100ULL, 0x050004A100100058ULL,
+    0x1200100508020020ULL, 0xD200020010080401ULL, 0x0880110002000080ULL, 0x0180004023000280ULL,
+    0x1000800020804001ULL, 0x0001004001002081ULL, 0x0041001020010042ULL, 0x2481001001040820ULL,
+    0x0001001004080102ULL, 0x0220800200800400ULL, 0x0889010002000401ULL, 0x0020802480184100ULL,
+    0x0800658004400188ULL, 0x8050420020910200ULL, 0x0032020020804010ULL, 0x0000808008001000ULL,
+    0x0044008008008004ULL, 0x0005010024002248ULL, 0x0011410100020004ULL, 0xC220020004204081ULL,
+    0x2080802080004000ULL, 0x0560008580400022ULL, 0x0010200100410014ULL, 0x0010000808010080ULL,
+    0x0004008080080004ULL, 0x5001000900340052ULL, 0x8001020400108801ULL, 0x0000408200040041ULL,
+    0x2818401020800080ULL, 0x4010002000400041ULL, 0x8001801004802004ULL, 0x8000080080801000ULL,
+    0xC002001006002048ULL, 0x2002000502000810ULL, 0x020D50012C001A08ULL, 0x5000040082000061ULL,
+    0x1080002001414000ULL, 0x02220100408A0021ULL, 0x0042420082120020ULL, 0x2201002090030008ULL,
+    0x0104080100050010ULL, 0x0082000204008080ULL, 0x4044020001008080ULL, 0x0088807400820009ULL,
+    0x0480002000400140ULL, 0x9040842040110100ULL, 0x0C08110020014300ULL, 0x0000100008028480ULL,
+    0x0100C40080880280ULL, 0x0002000400028080ULL, 0xC200100841121400ULL, 0x4818004120840200ULL,
+    0x8402208002401903ULL, 0x4011004000801021ULL, 0x00052010806A4202ULL, 0x4004082100100105ULL,
+    0x0402002005100802ULL, 0x9002000F04083086ULL, 0x5040024808900904ULL, 0x0000040021004082ULL,
+};
+
 template <PieceType pc>
 struct magics_t
 {
@@ -354,7 +401,11 @@ struct magics_t
         index_type               offset{};
         [[nodiscard]] index_type index(const Bitboard blockers) const
         {
+#if CHEPP_USE_PEXT
+            return offset + static_cast<index_type>(_pext_u64(blockers.value(), mask.value()));
+#else
             return offset + (((blockers & mask).value() * magic) >> shift);
+#endif
         }
     };
     static constexpr std::size_t sz = [] ()
@@ -395,19 +446,6 @@ inline const magics_t<ROOK>& magics<ROOK>() {
     return instance;
 }
 
-static uint64_t       random_u64()
-{
-    static std::random_device                      rd;
-    static std::mt19937                            gen(rd());
-    static std::uniform_int_distribution<uint64_t> dist(0, UINT64_MAX);
-    return dist(gen);
-}
-
-static uint64_t random_magic()
-{
-    return random_u64() & random_u64() & random_u64();
-}
-
 constexpr Bitboard mask_nb(const Bitboard mask, const uint64_t n)
 {
     Bitboard bb{0};
@@ -425,64 +463,36 @@ constexpr Bitboard mask_nb(const Bitboard mask, const uint64_t n)
     return bb;
 }
 
+// no search at startup, the tables are just filled in: same layout and offsets for both backends
 template <PieceType pc>
 magics_t<pc>::magics_t()
 {
-    constexpr uint64_t MAX_TRIES{UINT64_MAX};
+    static_assert(pc == BISHOP || pc == ROOK);
+    constexpr const auto& fixed_magics = pc == BISHOP ? g_bishop_magics : g_rook_magics;
+
     typename magic_val_t::index_type offset{0};
+    attacks.fill(bb::empty());
 
     for (auto sq = A1; sq <= H8; ++sq)
     {
-        const typename magic_val_t::mask_type mask{relevancy_mask<pc>(sq)};
-        const int nb_ones{mask.popcount()};
-        const int combinations{1 << nb_ones};
-        const typename magic_val_t::shift_type shift{64 - nb_ones};
-        typename magic_val_t::magic_type magic{0};
-
-        std::vector<Bitboard> cached_blockers(combinations);
-        std::vector<Bitboard> cached_attacks(combinations);
+        const Bitboard mask{relevancy_mask<pc>(sq)};
+        const int      nb_ones{mask.popcount()};
 
-        for (int comb = 0; comb < combinations; comb++)
-        {
-            cached_blockers[comb] = mask_nb(mask, comb);
-            cached_attacks[comb]  = ray<pc>(sq, cached_blockers[comb]);
-        }
+        magic_vals.at(sq) = magic_val_t{mask, fixed_magics[sq.index()], 64 - nb_ones, offset};
 
-        for (uint64_t tries = 1;; tries++)
+        // walk every subset of the mask (carry-rippler)
+        Bitboard blockers = bb::empty();
+        do
         {
-            std::vector<bool> tries_map(combinations, false);
-            bool fail{false};
-            magic = random_magic();
-
-            for (int c = 0; c < combinations; c++)
-            {
-                const typename magic_val_t::index_type index =
-                    (cached_blockers[c].value() * magic) >> shift;
-
-                if (tries_map[index] && (attacks.at(offset + index) != cached_attacks[c]))
-                {
-                    fail = true;
-                    break;
-                }
-                attacks.at(offset + index) = cached_attacks[c];
-                tries_map[index]           = true;
-            }
-
-            if (!fail)
-            {
-                break;
-            }
-            if (tries == MAX_TRIES - 1)
-            {
-                assert(0 && "failed to find magic");
-            }
-        }
-
-        magic_vals.at(sq).offset = offset;
-        magic_vals.at(sq).magic  = magic;
-        magic_vals.at(sq).mask   = mask;
-        magic_vals.at(sq).shift  = shift;
-        offset += combinations;
+            const Bitboard attack = ray<pc>(sq, blockers);
+            auto&          slot   = attacks.at(magic_vals[sq].index(blockers));
+            // a slider always attacks something, an empty slot is free and a used one must agree
+            assert(!slot || slot == attack);
+            slot     = attack;
+            blockers = Bitboard{(blockers.value() - mask.value()) & mask.value()};
+        } while (blockers);
+
+        offset += 1U << nb_ones;
     }
 }
 
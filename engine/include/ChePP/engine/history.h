@@ -1,6 +1,7 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
+#include "movegen.h"
 #include "position.h"
 #include "search_stack.h"
 
@@ -24,6 +25,10 @@ struct HistoryManager {
     std::unique_ptr<CaptureHistTable>  m_capture_hist{};
 
     HistoryManager() {
+        clear();
+    }
+
+    void clear() {
         m_hist         = std::make_unique<HistTable>();
         m_cont_hist    = std::make_unique<ContHistTable>();
         m_pawn_hist    = std::make_unique<HistTable>();
@@ -43,7 +48,7 @@ struct HistoryManager {
     }
 
     static HistTable& cont_hist_entry(ContHistTable& table, const SearchStack::Node& ss) {
-        return table[ss.pos->moved()][ss.pos->move().to_sq()];
+        return table[ss.moved][ss.move.to_sq()];
     }
 
     template <typename TableT, typename PieceFunc>
@@ -118,8 +123,8 @@ struct HistoryManager {
     void update_cont_hist(const SearchStack::Node& ss_init, const MoveList& quiets,
                           const Move best_move, int depth, int max_back = 2) {
         const SearchStack::Node* ss = &ss_init;
-        for (int back = 0; back < max_back && ss->prev(); ++back, ss = ss->prev()) {
-            if (ss->pos->move() == Move::null() || ss->pos->move() == Move::none()) continue;
+        for (int back = 0; back < max_back; ++back, ss = ss->prev()) {
+            if (ss->move == Move::null() || ss->move == Move::none()) continue;
             for (const auto& [m, _] : quiets) {
                 if (m == best_move)
                     update_cont_hist(*ss, m, [&](int score) { return score + depth * depth * 300; });
@@ -133,8 +138,8 @@ struct HistoryManager {
                                           const Move move, int max_back = 2) const {
         int bonus = 0;
         const SearchStack::Node* ss = &ss_init;
-        for (int back = 0; back < max_back && ss->prev(); ++back, ss = ss->prev()) {
-            if (ss->pos->move() == Move::null() || ss->pos->move() == Move::none()) continue;
+        for (int back = 0; back < max_back; ++back, ss = ss->prev()) {
+            if (ss->move == Move::null() || ss->move == Move::none()) continue;
             bonus += hist_entry(cont_hist_entry(*m_cont_hist, *ss), move, *ss->pos, [] (const Position& pos, const Move& move) {
                 return pos.piece_at(move.from_sq());
             });
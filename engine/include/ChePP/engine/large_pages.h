@@ -0,0 +1,81 @@
+#ifndef LARGE_PAGES_H
+#define LARGE_PAGES_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Big tables (the TT mostly) are backed by huge pages when the OS allows it, a 2MB page covers 32768 buckets
+// instead of 64 and saves most of the TLB misses on random probes.
+// On Linux we first try explicit huge pages (needs vm.nr_hugepages), then fall back to an aligned allocation
+// advised for transparent huge pages. Elsewhere it is a plain aligned allocation.
+
+inline constexpr std::size_t LARGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+struct LargePageDeleter
+{
+    std::size_t m_bytes{};
+    bool        m_mapped{};
+
+    void operator()(void* ptr) const
+    {
+        if (!ptr)
+            return;
+#if defined(__linux__)
+        if (m_mapped)
+        {
+            munmap(ptr, m_bytes);
+            return;
+        }
+#endif
+#if defined(_WIN32)
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif
+    }
+};
+
+// storage is left uninitialised, the owner constructs its objects (possibly from several threads)
+template <typename T>
+using LargePageArray = std::unique_ptr<T[], LargePageDeleter>;
+
+template <typename T>
+LargePageArray<T> allocate_large_pages(const std::size_t n)
+{
+    static_assert(std::is_trivially_destructible_v<T>, "destructors are never run on large page arrays");
+
+    const std::size_t bytes = (n * sizeof(T) + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE * LARGE_PAGE_SIZE;
+    void*             ptr   = nullptr;
+
+#if defined(__linux__)
+    ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+    {
+        return LargePageArray<T>(static_cast<T*>(ptr), LargePageDeleter{bytes, true});
+    }
+    ptr = std::aligned_alloc(LARGE_PAGE_SIZE, bytes);
+    if (ptr)
+    {
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+#elif defined(_WIN32)
+    ptr = _aligned_malloc(bytes, LARGE_PAGE_SIZE);
+#else
+    ptr = std::aligned_alloc(LARGE_PAGE_SIZE, bytes);
+#endif
+
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return LargePageArray<T>(static_cast<T*>(ptr), LargePageDeleter{bytes, false});
+}
+
+#endif // LARGE_PAGES_H
@@ -2,6 +2,7 @@
 #define MOVE_ORDERING_H
 
 #include "history.h"
+#include "movegen.h"
 #include "search_stack.h"
 #include "types.h"
 
@@ -12,8 +13,12 @@ inline void score_moves(const SearchStack::Node& ss,
                         const SearchStack::Node& ssNode
                         )
 {
-    for (auto& [move, score] : list)
+    std::array<int, MoveList::max_moves> see;
+    see_all(*ss.pos, list, see);
+
+    for (size_t i = 0; i < list.size(); i++)
     {
+        auto& [move, score] = list[i];
         score  = 0;
         if (move == prev_best) {
             score += 500'000'000;
@@ -26,7 +31,7 @@ inline void score_moves(const SearchStack::Node& ss,
         if (move.type_of() == PROMOTION)
             score += (move.promotion_type().piece_value()) * 100'000;
         if (victim)
-            score += ss.pos->see(move) * 100'000 + history.get_capture_hist_score(ss, move);
+            score += see[i] * 100'000 + history.get_capture_hist_score(ss, move);
         if (!victim && move.type_of() != PROMOTION)
         {
             score += history.get_cont_hist_bonus(ss, move);
@@ -35,5 +40,203 @@ inline void score_moves(const SearchStack::Node& ss,
     }
 }
 
+// Hands out the moves of a node one at a time, in stages: tt move, good captures, killers, quiets and bad captures.
+// A stage is only generated and scored once the previous ones ran out, and each move is picked with a selection
+// over what is left instead of sorting the whole list, so a node that cuts on the tt move never generates anything.
+// Moves are only pseudo legal (except at the root), the caller checks is_legal right before playing one
+class MovePicker
+{
+  public:
+    enum Stage
+    {
+        TT_MOVE,
+        GEN_CAPTURES,
+        GOOD_CAPTURES,
+        KILLER1,
+        KILLER2,
+        GEN_QUIETS,
+        QUIET_MOVES,
+        BAD_CAPTURES,
+        ROOT_MOVES,
+        DONE,
+    };
+
+    MovePicker(const SearchStack::Node& ss, const Move tt_move, const HistoryManager& history)
+        : m_ss(ss), m_history(history), m_tt_move(tt_move), m_killer1(ss.killer1), m_killer2(ss.killer2),
+          m_stage(TT_MOVE)
+    {
+    }
+
+    // probcut, only the captures that do not lose material
+    MovePicker(const SearchStack::Node& ss, const HistoryManager& history)
+        : m_ss(ss), m_history(history), m_tt_move(Move::none()), m_stage(GEN_CAPTURES), m_captures_only(true)
+    {
+    }
+
+    // root, the moves are already generated and scored by the caller
+    MovePicker(const SearchStack::Node& ss, const MoveList& root_moves, const HistoryManager& history)
+        : m_ss(ss), m_history(history), m_tt_move(Move::none()), m_stage(ROOT_MOVES), m_moves(root_moves),
+          m_end(root_moves.size())
+    {
+    }
+
+    // returns Move::none() once there is nothing left. With skip_quiets the killers and quiets are not tried anymore
+    Move next(const bool skip_quiets = false)
+    {
+        const Position& pos = *m_ss.pos;
+        switch (m_stage)
+        {
+            case TT_MOVE:
+                m_stage = GEN_CAPTURES;
+                if (pos.is_pseudo_legal(m_tt_move))
+                    return m_tt_move;
+                [[fallthrough]];
+
+            case GEN_CAPTURES:
+                gen_moves<CAPTURES>(pos, m_moves);
+                m_end     = m_moves.size();
+                m_bad_end = 0;
+                score_captures();
+                m_cur   = m_bad_end;
+                m_stage = GOOD_CAPTURES;
+                [[fallthrough]];
+
+            case GOOD_CAPTURES:
+                if (const Move m = select(m_cur, m_end); m != Move::none())
+                    return m;
+                if (m_captures_only)
+                {
+                    m_stage = DONE;
+                    return Move::none();
+                }
+                m_stage = KILLER1;
+                [[fallthrough]];
+
+            case KILLER1:
+                m_stage = KILLER2;
+                if (!skip_quiets && is_killer_ok(m_killer1))
+                    return m_killer1;
+                [[fallthrough]];
+
+            case KILLER2:
+                m_stage = GEN_QUIETS;
+                if (!skip_quiets && m_killer2 != m_killer1 && is_killer_ok(m_killer2))
+                    return m_killer2;
+                [[fallthrough]];
+
+            case GEN_QUIETS:
+                if (!skip_quiets)
+                {
+                    gen_moves<QUIETS>(pos, m_moves);
+                    m_cur = m_end;
+                    m_end = m_moves.size();
+                    score_quiets();
+                }
+                m_stage = QUIET_MOVES;
+                [[fallthrough]];
+
+            case QUIET_MOVES:
+                if (!skip_quiets)
+                {
+                    if (const Move m = select(m_cur, m_end); m != Move::none())
+                        return m;
+                }
+                m_cur   = 0;
+                m_stage = BAD_CAPTURES;
+                [[fallthrough]];
+
+            case BAD_CAPTURES:
+                if (const Move m = select(m_cur, m_bad_end); m != Move::none())
+                    return m;
+                m_stage = DONE;
+                return Move::none();
+
+            case ROOT_MOVES:
+                return select(m_cur, m_end);
+
+            case DONE:
+                return Move::none();
+        }
+        return Move::none();
+    }
+
+    [[nodiscard]] Stage stage() const { return m_stage; }
+
+  private:
+    // brings the best remaining move of [cur, end) in front and returns it, skipping what was already handed out
+    Move select(size_t& cur, const size_t end)
+    {
+        while (cur < end)
+        {
+            const auto best = std::max_element(m_moves.begin() + cur, m_moves.begin() + end);
+            std::iter_swap(m_moves.begin() + cur, best);
+            const Move m = m_moves[cur++].move;
+            if (!is_special(m))
+                return m;
+        }
+        return Move::none();
+    }
+
+    // the moves handed out in a stage of their own
+    [[nodiscard]] bool is_special(const Move m) const
+    {
+        return m == m_tt_move || (m_stage == QUIET_MOVES && (m == m_killer1 || m == m_killer2));
+    }
+
+    [[nodiscard]] bool is_killer_ok(const Move m) const
+    {
+        const Position& pos = *m_ss.pos;
+        return m != m_tt_move && pos.is_pseudo_legal(m) && !pos.is_occupied(m.to_sq()) &&
+               (m.type_of() == NORMAL || m.type_of() == CASTLING);
+    }
+
+    // same scale as score_moves. Captures losing material go to the front of the list and wait for the last stage
+    void score_captures()
+    {
+        const Position& pos = *m_ss.pos;
+
+        std::array<int, MoveList::max_moves> see;
+        see_all(pos, m_moves, see);
+
+        for (size_t i = 0; i < m_end; i++)
+        {
+            auto& [move, score] = m_moves[i];
+            const auto victim   = move.type_of() == EN_PASSANT ? PAWN : pos.piece_at(move.to_sq()).type();
+
+            score = 0;
+            if (move.type_of() == PROMOTION)
+                score += move.promotion_type().piece_value() * 100'000;
+            if (victim)
+                score += see[i] * 100'000 + m_history.get_capture_hist_score(m_ss, move);
+            if (see[i] < 0)
+                std::swap(m_moves[i], m_moves[m_bad_end++]);
+        }
+    }
+
+    void score_quiets()
+    {
+        for (size_t i = m_cur; i < m_end; i++)
+        {
+            auto& [move, score] = m_moves[i];
+            score = m_history.get_cont_hist_bonus(m_ss, move) + m_history.get_hist_score(m_ss, move);
+        }
+    }
+
+    const SearchStack::Node& m_ss;
+    const HistoryManager&    m_history;
+    Move                     m_tt_move;
+    // copied, the node's killers can change while its moves are being searched
+    Move                     m_killer1 = Move::none();
+    Move                     m_killer2 = Move::none();
+    Stage                    m_stage;
+    bool                     m_captures_only = false;
+
+    // [0, bad_end) bad captures, [bad_end, end) the stage being picked from
+    MoveList m_moves{};
+    size_t   m_cur     = 0;
+    size_t   m_end     = 0;
+    size_t   m_bad_end = 0;
+};
+
 
 #endif // MOVE_ORDERING_H
@@ -6,6 +6,7 @@
 #include "types.h"
 
 #include <ranges>
+#include <span>
 
 struct ScoredMove
 {
@@ -112,6 +113,32 @@ struct MoveList
     size_type                         m_size;
 };
 
+// SEE of every capture of a list at once, the attackers of a square are computed a single time for all the moves
+// landing on it. Moves that are not captures get 0
+inline void see_all(const Position& pos, const MoveList& list, std::span<int> out)
+{
+    assert(out.size() >= list.size());
+
+    EnumArray<Square, Bitboard> attackers{};
+    Bitboard                    known{};
+    for (size_t i = 0; i < list.size(); i++)
+    {
+        const Move move = list[i].move;
+        const Square to = move.to_sq();
+        if (!pos.is_occupied(to) && move.type_of() != EN_PASSANT)
+        {
+            out[i] = 0;
+            continue;
+        }
+        if (!known.is_set(to))
+        {
+            attackers.at(to) = pos.attacking_sq(to);
+            known.set(to);
+        }
+        out[i] = pos.see(move, attackers.at(to));
+    }
+}
+
 inline void make_all_promotions(MoveList& list, const Square from, const Square to)
 {
     list.add(Move::make<PROMOTION>(from, to, QUEEN));
@@ -131,7 +158,15 @@ inline void add_promotions(MoveList& list, const Bitboard bb, const int delta)
     bb.for_each_square([&](const Square to) { make_all_promotions(list, to - delta, to); });
 }
 
-template <Color c>
+// what a generator call produces. Captures include every promotion, quiets are the rest
+enum GenType
+{
+    CAPTURES,
+    QUIETS,
+    ALL,
+};
+
+template <Color c, GenType T = ALL>
 void gen_pawn_moves(const Position& pos, MoveList& list)
 {
     constexpr auto up{relative_dir<c, NORTH>};
@@ -148,6 +183,7 @@ void gen_pawn_moves(const Position& pos, MoveList& list)
     const Bitboard     ep_bb      = pos.ep_square() == NO_SQUARE ? bb::empty() : bb(pos.ep_square());
 
     // straight
+    if constexpr (T != CAPTURES)
     {
         Bitboard single_push = shift<up>(pawns & ~bb_promotion_rank) & available;
         Bitboard double_push = shift<up>(single_push & bb_third_rank) & available & check_mask;
@@ -156,6 +192,9 @@ void gen_pawn_moves(const Position& pos, MoveList& list)
         add_moves_from_bb<NORMAL>(list, single_push, up);
         add_moves_from_bb<NORMAL>(list, double_push, up + up);
     }
+    if constexpr (T == QUIETS)
+        return;
+
     // promotion
     if (const Bitboard promotions = pawns & bb_promotion_rank)
     {
@@ -192,17 +231,30 @@ void gen_pawn_moves(const Position& pos, MoveList& list)
     }
 }
 
-template <PieceType pc>
+// squares a non pawn move may land on for a given generation type
+template <GenType T>
+Bitboard gen_targets(const Position& pos, const Color c)
+{
+    if constexpr (T == CAPTURES)
+        return pos.occupancy(~c);
+    else if constexpr (T == QUIETS)
+        return ~pos.occupancy();
+    else
+        return ~pos.occupancy(c);
+}
+
+template <PieceType pc, GenType T = ALL>
 void gen_pc_moves(const Position& pos, MoveList& list)
 {
     const Color    c = pos.side_to_move();
     const Bitboard check_mask{pos.check_mask(c) == bb::empty() ? bb::full() : pos.check_mask(c)};
+    const Bitboard targets{gen_targets<T>(pos, c) & check_mask};
     Bitboard       bb{pos.occupancy(c, pc)};
 
     bb.for_each_square(
         [&](const Square from)
         {
-            Bitboard atk{attacks<pc>(from, pos.occupancy()) & ~pos.occupancy(c) & check_mask};
+            Bitboard atk{attacks<pc>(from, pos.occupancy()) & targets};
             atk.for_each_square([&](const Square to) { list.add(Move::make<NORMAL>(from, to)); });
         });
 }
@@ -237,34 +289,51 @@ inline void gen_castling(const Position& pos, MoveList& list)
     }
 }
 
-inline void gen_king_moves(const Position& pos, MoveList& list)
+template <GenType T = ALL>
+void gen_king_moves(const Position& pos, MoveList& list)
 {
     const Color    c     = pos.side_to_move();
     const Square   from  = pos.ksq(c);
     const Bitboard moves = attacks<KING>(from, pos.occupancy());
 
-    (moves & (~pos.occupancy() | pos.occupancy(~c))) // unoccupied or capture
-        .for_each_square([&](const Square to) { list.add(Move::make<NORMAL>(from, to)); });
+    (moves & gen_targets<T>(pos, c)).for_each_square([&](const Square to) { list.add(Move::make<NORMAL>(from, to)); });
 
-    gen_castling(pos, list);
+    if constexpr (T != CAPTURES)
+        gen_castling(pos, list);
 }
 
-template <Color c>
-MoveList gen_moves(const Position& pos)
+// appends the pseudo legal moves of the given type, the list can already hold moves from another stage
+template <GenType T, Color c>
+void gen_moves(const Position& pos, MoveList& list)
 {
-    MoveList  list;
     const int n_checkers = pos.checkers(c).popcount();
     assert(n_checkers <= 2);
 
     if (n_checkers != 2)
     {
-        gen_pawn_moves<c>(pos, list);
-        gen_pc_moves<BISHOP>(pos, list);
-        gen_pc_moves<KNIGHT>(pos, list);
-        gen_pc_moves<ROOK>(pos, list);
-        gen_pc_moves<QUEEN>(pos, list);
+        gen_pawn_moves<c, T>(pos, list);
+        gen_pc_moves<BISHOP, T>(pos, list);
+        gen_pc_moves<KNIGHT, T>(pos, list);
+        gen_pc_moves<ROOK, T>(pos, list);
+        gen_pc_moves<QUEEN, T>(pos, list);
     }
-    gen_king_moves(pos, list);
+    gen_king_moves<T>(pos, list);
+}
+
+template <GenType T>
+void gen_moves(const Position& pos, MoveList& list)
+{
+    if (pos.side_to_move() == WHITE)
+        gen_moves<T, WHITE>(pos, list);
+    else
+        gen_moves<T, BLACK>(pos, list);
+}
+
+template <Color c>
+MoveList gen_moves(const Position& pos)
+{
+    MoveList list;
+    gen_moves<ALL, c>(pos, list);
     return list;
 }
 
@@ -0,0 +1,354 @@
+#ifndef CHEPP_NETWORK_H
+#define CHEPP_NETWORK_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "network_net.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The weights used by the inference code. By default they point at the network embedded at build time, an EvalFile
+// can replace them with a versioned network file mapped read-only, so every engine process on the host shares the
+// same page cache copy.
+//
+// Versioned network file, little endian:
+//   header      64 bytes : magic "ChePPnet", uint32 version, uint32 layer count, padding
+//   layer table 64 bytes per layer : uint8 type (bin2h LayerType), 7 padding bytes, uint64 size, char name[48]
+//   data        every layer starts on a 64 byte boundary, in table order
+// The table has to match resources/layers.json, i.e. the embedded declarations, name type and size for each layer.
+// bin2h --net writes such a file from a raw network.
+
+struct NetworkFileHeader
+{
+    static constexpr std::array<char, 8> s_magic   = {'C', 'h', 'e', 'P', 'P', 'n', 'e', 't'};
+    static constexpr uint32_t            s_version = 1;
+
+    std::array<char, 8> magic{};
+    uint32_t            version{};
+    uint32_t            n_layers{};
+    std::array<char, 48> padding{};
+};
+
+struct NetworkFileLayer
+{
+    uint8_t              type{};
+    std::array<uint8_t, 7> padding{};
+    uint64_t             size{};
+    std::array<char, 48> name{};
+};
+
+static_assert(sizeof(NetworkFileHeader) == 64 && sizeof(NetworkFileLayer) == 64);
+
+class Network
+{
+  public:
+    enum Layer : std::size_t
+    {
+        FT_WEIGHTS,
+        FT_BIASES,
+        PSQT_WEIGHTS,
+        PSQT_BIASES,
+        L1_PSQT_WEIGHTS,
+        L1_PSQT_BIASES,
+        L1_WEIGHTS,
+        L1_BIASES,
+        L2_WEIGHTS,
+        L2_BIASES,
+        OUT_WEIGHTS,
+        OUT_BIAS,
+        N_LAYERS
+    };
+
+    struct LayerInfo
+    {
+        std::string_view name;
+        uint8_t          type;
+        uint64_t         size;
+        const void*      embedded;
+    };
+
+    static constexpr std::size_t n_buckets = std::size(g_out_bias);
+    static constexpr std::size_t ft_size   = std::size(g_ft_biases);
+    static constexpr std::size_t l1_size   = std::size(g_l1_biases) / n_buckets;
+
+    Network() { load_embedded(); }
+    ~Network() { unmap(); }
+
+    Network(const Network&)            = delete;
+    Network& operator=(const Network&) = delete;
+
+    void load_embedded()
+    {
+        unmap();
+        for (std::size_t i = 0; i < N_LAYERS; i++)
+        {
+            m_layers[i] = table()[i].embedded;
+        }
+        m_name = "<embedded>";
+        on_change();
+    }
+
+    // on failure the current network is kept
+    bool load(const std::string& path)
+    {
+        std::size_t size = 0;
+        void*       map  = map_file(path, size);
+        if (!map)
+        {
+            std::cerr << "Could not map network file: " << path << "\n";
+            return false;
+        }
+
+        std::array<const void*, N_LAYERS> layers{};
+        if (const std::string error = validate(static_cast<const uint8_t*>(map), size, layers); !error.empty())
+        {
+            std::cerr << "Invalid network file " << path << ": " << error << "\n";
+            unmap_file(map, size);
+            return false;
+        }
+
+        unmap();
+        m_map      = map;
+        m_map_size = size;
+        m_layers   = layers;
+        m_name     = path;
+        on_change();
+        return true;
+    }
+
+    [[nodiscard]] const std::string& name() const { return m_name; }
+
+    // bumped on every load, caches derived from the weights compare against it
+    [[nodiscard]] uint64_t generation() const { return m_generation; }
+
+    [[nodiscard]] const int16_t* ft_weights() const { return get<int16_t>(FT_WEIGHTS); }
+    [[nodiscard]] const int16_t* ft_biases() const { return get<int16_t>(FT_BIASES); }
+    [[nodiscard]] const int16_t* psqt_weights() const { return get<int16_t>(PSQT_WEIGHTS); }
+    [[nodiscard]] const int16_t* psqt_biases() const { return get<int16_t>(PSQT_BIASES); }
+    [[nodiscard]] const int16_t* l1_psqt_weights() const { return get<int16_t>(L1_PSQT_WEIGHTS); }
+    [[nodiscard]] const int32_t* l1_psqt_biases() const { return get<int32_t>(L1_PSQT_BIASES); }
+    [[nodiscard]] const int16_t* l1_weights() const { return get<int16_t>(L1_WEIGHTS); }
+    [[nodiscard]] const int32_t* l1_biases() const { return get<int32_t>(L1_BIASES); }
+    [[nodiscard]] const int16_t* l2_weights() const { return get<int16_t>(L2_WEIGHTS); }
+    [[nodiscard]] const int32_t* l2_biases() const { return get<int32_t>(L2_BIASES); }
+    [[nodiscard]] const int16_t* out_weights() const { return get<int16_t>(OUT_WEIGHTS); }
+    [[nodiscard]] const int32_t* out_bias() const { return get<int32_t>(OUT_BIAS); }
+
+    // L1 weights reordered for the sparse L1 path as [bucket][input pair][output][2]
+    [[nodiscard]] const int16_t* l1_sparse_weights() const { return m_l1_sparse->w.data(); }
+
+    // layer table of the embedded network, in the order of resources/layers.json
+    static const std::array<LayerInfo, N_LAYERS>& table()
+    {
+        static const std::array<LayerInfo, N_LAYERS> g_table = {{
+            info("g_ft_weights", g_ft_weights),
+            info("g_ft_biases", g_ft_biases),
+            info("g_psqt_weights", g_psqt_weights),
+            info("g_psqt_biases", g_psqt_biases),
+            info("g_l1_psqt_weights", g_l1_psqt_weights),
+            info("g_l1_psqt_biases", g_l1_psqt_biases),
+            info("g_l1_weights", g_l1_weights),
+            info("g_l1_biases", g_l1_biases),
+            info("g_l2_weights", g_l2_weights),
+            info("g_l2_biases", g_l2_biases),
+            info("g_out_weights", g_out_weights),
+            info("g_out_bias", g_out_bias),
+        }};
+        return g_table;
+    }
+
+    // same codes as LayerType in scripts/bin2h.cpp
+    template <typename T>
+    static constexpr uint8_t type_code()
+    {
+        if constexpr (std::is_same_v<T, uint8_t>) return 1;
+        else if constexpr (std::is_same_v<T, int8_t>) return 2;
+        else if constexpr (std::is_same_v<T, uint16_t>) return 3;
+        else if constexpr (std::is_same_v<T, int16_t>) return 4;
+        else if constexpr (std::is_same_v<T, uint32_t>) return 5;
+        else if constexpr (std::is_same_v<T, int32_t>) return 6;
+        else if constexpr (std::is_same_v<T, uint64_t>) return 7;
+        else if constexpr (std::is_same_v<T, int64_t>) return 8;
+        else if constexpr (std::is_same_v<T, float>) return 9;
+        else if constexpr (std::is_same_v<T, double>) return 10;
+    }
+
+    static constexpr std::size_t type_size(const uint8_t code)
+    {
+        constexpr std::array<std::size_t, 11> sizes = {0, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8};
+        return code < sizes.size() ? sizes[code] : 0;
+    }
+
+  private:
+    struct alignas(64) SparseL1Weights
+    {
+        std::array<int16_t, std::size(g_l1_weights)> w;
+    };
+
+    template <typename T, std::size_t N>
+    static constexpr LayerInfo info(const std::string_view name, const T (&data)[N])
+    {
+        return {name, type_code<T>(), N, data};
+    }
+
+    template <typename T>
+    [[nodiscard]] const T* get(const Layer l) const
+    {
+        return static_cast<const T*>(m_layers[l]);
+    }
+
+    static std::size_t align_up(const std::size_t x) { return (x + 63) / 64 * 64; }
+
+    // checks the header and the layer table against the embedded one, fills the layer pointers on success
+    static std::string validate(const uint8_t* data, const std::size_t size, std::array<const void*, N_LAYERS>& layers)
+    {
+        NetworkFileHeader header;
+        if (size < sizeof(header))
+            return "file too small";
+        std::memcpy(&header, data, sizeof(header));
+
+        if (header.magic != NetworkFileHeader::s_magic)
+            return "bad magic, not a versioned network (raw networks have to go through bin2h --net)";
+        if (header.version != NetworkFileHeader::s_version)
+            return "unsupported version " + std::to_string(header.version);
+        if (header.n_layers != N_LAYERS)
+            return "expected " + std::to_string(N_LAYERS) + " layers, got " + std::to_string(header.n_layers);
+
+        std::size_t offset = sizeof(NetworkFileHeader) + N_LAYERS * sizeof(NetworkFileLayer);
+        if (size < offset)
+            return "truncated layer table";
+
+        for (std::size_t i = 0; i < N_LAYERS; i++)
+        {
+            NetworkFileLayer layer;
+            std::memcpy(&layer, data + sizeof(NetworkFileHeader) + i * sizeof(NetworkFileLayer), sizeof(layer));
+
+            const LayerInfo&       expected = table()[i];
+            const std::string_view name(layer.name.data(), strnlen(layer.name.data(), layer.name.size()));
+            if (name != expected.name || layer.type != expected.type || layer.size != expected.size)
+                return "layer " + std::to_string(i) + " (" + std::string(name) + ") does not match " +
+                       std::string(expected.name);
+
+            offset = align_up(offset);
+            const std::size_t bytes = layer.size * type_size(layer.type);
+            if (offset + bytes > size)
+                return "truncated layer " + std::string(name);
+            layers[i] = data + offset;
+            offset += bytes;
+        }
+        if (offset != size)
+            return "trailing data after the last layer";
+        return {};
+    }
+
+    void on_change()
+    {
+        if (!m_l1_sparse)
+            m_l1_sparse = std::make_unique<SparseL1Weights>();
+        permute_l1_weights(l1_weights(), m_l1_sparse->w.data());
+        ++m_generation;
+    }
+
+    static void permute_l1_weights(const int16_t* src, int16_t* dst)
+    {
+        for (std::size_t b = 0; b < n_buckets; b++)
+        {
+            for (std::size_t i = 0; i < l1_size; i++)
+            {
+                for (std::size_t n = 0; n < ft_size * 2; n++)
+                {
+                    const std::size_t pair = n / 2;
+                    dst[((b * ft_size + pair) * l1_size + i) * 2 + n % 2] = src[(b * l1_size + i) * ft_size * 2 + n];
+                }
+            }
+        }
+    }
+
+    static void* map_file(const std::string& path, std::size_t& size)
+    {
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return nullptr;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return nullptr;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            return nullptr;
+        void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        size = static_cast<std::size_t>(file_size.QuadPart);
+        return ptr;
+#else
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+        void* ptr = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+            return nullptr;
+        size = static_cast<std::size_t>(st.st_size);
+        return ptr;
+#endif
+    }
+
+    static void unmap_file(void* ptr, const std::size_t size)
+    {
+#if defined(_WIN32)
+        (void)size;
+        UnmapViewOfFile(ptr);
+#else
+        munmap(ptr, size);
+#endif
+    }
+
+    void unmap()
+    {
+        if (m_map)
+            unmap_file(m_map, m_map_size);
+        m_map      = nullptr;
+        m_map_size = 0;
+    }
+
+    std::array<const void*, N_LAYERS> m_layers{};
+    std::unique_ptr<SparseL1Weights>  m_l1_sparse{};
+    std::string                       m_name{};
+    uint64_t                          m_generation{};
+
+    void*       m_map{};
+    std::size_t m_map_size{};
+};
+
+inline Network g_network;
+
+#endif // CHEPP_NETWORK_H
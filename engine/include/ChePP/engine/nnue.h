@@ -3,14 +3,17 @@
 
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <memory>
+#include <optional>
 #include <vector>
 
-#include "network_net.h"
+#include "network.h"
 #include "position.h"
 
 template <typename T, size_t MaxSize>
@@ -70,41 +73,65 @@ struct FeatureTransformer
 
     static constexpr size_t n_features_v = 32 * 11 * 64;
 
-    static bool needs_refresh(const Position& cur, const Position& prev, const Color view)
+    // every piece of the position, for an accumulator built from scratch
+    static std::pair<RetT, RetT> get_features(const Position& pos, const Color view)
     {
-        return prev.ksq(view) != cur.ksq(view);
+        RetT add_v;
+        pos.occupancy().for_each_square([&](const Square& sq)
+                                        { add_v.push_back(get_index(view, pos.ksq(view), sq, pos.piece_at(sq))); });
+        return {add_v, RetT{}};
     }
 
-    static std::pair<RetT, RetT> get_features(const Position& cur, const Position& prev, const Color view,
-                                              const bool refresh)
-
+    // features changed by a single move, for a perspective whose king did not move (ksq is the same before and after)
+    static std::pair<RetT, RetT> get_features(const Move move, const Piece moved, const Piece captured,
+                                              const Square ksq, const Color view)
     {
         RetT add_v;
         RetT rem_v;
 
-        if (refresh)
+        auto add = [&](const Square sq, const Piece pc) { add_v.push_back(get_index(view, ksq, sq, pc)); };
+        auto rem = [&](const Square sq, const Piece pc) { rem_v.push_back(get_index(view, ksq, sq, pc)); };
+
+        const Color us = moved.color();
+        if (move.type_of() == CASTLING)
         {
-            cur.occupancy().for_each_square([&](const Square& sq)
-                                            { add_v.push_back(get_index(view, cur.ksq(view), sq, cur.piece_at(sq))); });
+            const auto [k_from, k_to] = move.castling_type().king_move();
+            const auto [r_from, r_to] = move.castling_type().rook_move();
+            rem(k_from, Piece{us, KING});
+            add(k_to, Piece{us, KING});
+            rem(r_from, Piece{us, ROOK});
+            add(r_to, Piece{us, ROOK});
+            return {add_v, rem_v};
         }
-        else
-        {
-            auto add = [&](const Square sq, const Piece pc)
-            { add_v.push_back(get_index(view, cur.ksq(view), sq, pc)); };
-            auto rem = [&](const Square sq, const Piece pc)
-            { rem_v.push_back(get_index(view, cur.ksq(view), sq, pc)); };
 
-            const EnumArray<Color, Bitboard> color_diff = {
-                prev.occupancy(WHITE) ^ cur.occupancy(WHITE),
-                prev.occupancy(BLACK) ^ cur.occupancy(BLACK),
-            };
+        rem(move.from_sq(), moved);
+        add(move.to_sq(), move.type_of() == PROMOTION ? Piece{us, move.promotion_type()} : moved);
+        if (move.type_of() == EN_PASSANT)
+            rem(move.to_sq() - (us == WHITE ? NORTH : SOUTH), Piece{~us, PAWN});
+        else if (captured)
+            rem(move.to_sq(), captured);
+
+        return {add_v, rem_v};
+    }
+
+    // features to go from the pieces cached for this king square to cur, used by the accumulator cache on refreshes
+    static std::pair<RetT, RetT> get_features(const Position& cur, const EnumArray<Piece, Bitboard>& cached,
+                                              const Color view)
+    {
+        RetT add_v;
+        RetT rem_v;
 
-            for (const auto c : {WHITE, BLACK})
+        for (const auto c : {WHITE, BLACK})
+        {
+            for (const auto pt : {PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING})
             {
-                color_diff.at(c).for_each_square( [&](const Square& sq){
-                    if (prev.occupancy(c).is_set(sq)) rem(sq, prev.piece_at(sq));
-                    else add(sq, cur.piece_at(sq));
-                });
+                const Piece    pc{c, pt};
+                const Bitboard now    = cur.occupancy(c, pt);
+                const Bitboard before = cached[pc];
+                (now & ~before).for_each_square([&](const Square& sq)
+                                                { add_v.push_back(get_index(view, cur.ksq(view), sq, pc)); });
+                (before & ~now).for_each_square([&](const Square& sq)
+                                                { rem_v.push_back(get_index(view, cur.ksq(view), sq, pc)); });
             }
         }
         return {add_v, rem_v};
@@ -150,6 +177,8 @@ using namespace hwy::HWY_NAMESPACE;
 
 #define ALIGN_PTR(T, ptr) (static_cast<T*>(HWY_ASSUME_ALIGNED(ptr, 64)))
 
+struct AccumulatorCache;
+
 struct Accumulator
 {
     static constexpr auto OutSz = 1024;
@@ -169,27 +198,19 @@ struct Accumulator
 
     size_t m_bucket;
 
-
+    static_assert(OutSz == Network::ft_size && L1Sz == Network::l1_size, "network layout does not match");
 
   public:
     Accumulator() = default;
     explicit Accumulator(const Position& pos)
     {
-        const auto [wadd, wrem] = FeatureTransformer::get_features(pos, pos, WHITE, true);
+        const auto [wadd, wrem] = FeatureTransformer::get_features(pos, WHITE);
         refresh_acc(WHITE, wadd);
-        const auto [badd, brem] = FeatureTransformer::get_features(pos, pos, BLACK, true);
+        const auto [badd, brem] = FeatureTransformer::get_features(pos, BLACK);
         refresh_acc(BLACK, badd);
         m_bucket = (pos.occupancy().popcount() - 1) / 4;
     }
 
-    explicit Accumulator(const Accumulator& acc_prev, const Position& pos_cur, const Position& pos_prev)
-    {
-        update(acc_prev, pos_cur, pos_prev, WHITE);
-        update(acc_prev, pos_cur, pos_prev, BLACK);
-        m_bucket = (pos_cur.occupancy().popcount() - 1) / 4;
-
-    }
-
 
     [[nodiscard]] void evaluate_uci(const Color view) const
     {
@@ -214,38 +235,41 @@ struct Accumulator
     template <size_t UNROLL = 4>
     [[nodiscard]] int32_t evaluate(const Color view, const size_t bucket) const
     {
-        const auto* HWY_RESTRICT our_acc_ptr = ALIGN_PTR(int16_t, view == WHITE ? white_accumulator.data() : black_accumulator.data());
-        const auto* HWY_RESTRICT their_acc_ptr = ALIGN_PTR(int16_t, view == WHITE ? black_accumulator.data() : white_accumulator.data());
-        const auto* HWY_RESTRICT our_psqt_ptr = ALIGN_PTR(int16_t, view == WHITE ? white_psqt.data() : black_psqt.data());
-        const auto* HWY_RESTRICT their_psqt_ptr = ALIGN_PTR(int16_t, view == WHITE ? black_psqt.data() : white_psqt.data());
+        HWY_ALIGN std::array<int32_t, L1Sz> l1_out{};
+        int32_t l1_psqt_out{};
+        propagate_l1_sparse(view, bucket, l1_out, l1_psqt_out);
+        return propagate_output(view, bucket, l1_out, l1_psqt_out);
+    }
 
-        const auto* HWY_RESTRICT l1_weights_ptr = ALIGN_PTR(int16_t, &g_l1_weights[bucket * OutSz * L1Sz * 2]);
-        const auto* HWY_RESTRICT l2_weights_ptr = ALIGN_PTR(int16_t, &g_l2_weights[bucket * L1Sz * L2Sz]);
-        const auto* HWY_RESTRICT out_weights_ptr = ALIGN_PTR(int16_t, &g_out_weights[bucket * L2Sz]);
-        const auto* HWY_RESTRICT l1_psqt_weights_ptr = ALIGN_PTR(int16_t, &g_l1_psqt_weights[bucket * OutSz * 2]);
+    // reference path multiplying the whole accumulator against L1, gives exactly the same result as evaluate
+    template <size_t UNROLL = 4>
+    [[nodiscard]] int32_t evaluate_dense(const Color view, const size_t bucket) const
+    {
+        HWY_ALIGN std::array<int32_t, L1Sz> l1_out{};
+        int32_t l1_psqt_out{};
+        propagate_l1_dense<UNROLL>(view, bucket, l1_out, l1_psqt_out);
+        return propagate_output(view, bucket, l1_out, l1_psqt_out);
+    }
 
-        const auto* HWY_RESTRICT l1_biases_ptr = ALIGN_PTR(int16_t, &g_l1_biases[bucket * L1Sz]);
-        const auto* HWY_RESTRICT l2_biases_ptr = ALIGN_PTR(int32_t, &g_l2_biases[bucket * L2Sz]);
-        const auto* HWY_RESTRICT out_biases_ptr = ALIGN_PTR(int32_t, &g_out_bias[bucket]);
-        const auto* HWY_RESTRICT l1_psqt_bias_ptr = ALIGN_PTR(int32_t, &g_l1_psqt_biases[bucket]);
+  private:
+    template <size_t UNROLL = 4>
+    void propagate_l1_dense(const Color view, const size_t bucket, std::array<int32_t, L1Sz>& l1_out,
+                            int32_t& l1_psqt_out) const
+    {
+        const auto* HWY_RESTRICT our_acc_ptr = ALIGN_PTR(int16_t, view == WHITE ? white_accumulator.data() : black_accumulator.data());
+        const auto* HWY_RESTRICT their_acc_ptr = ALIGN_PTR(int16_t, view == WHITE ? black_accumulator.data() : white_accumulator.data());
 
+        const auto* HWY_RESTRICT l1_weights_ptr = ALIGN_PTR(int16_t, &g_network.l1_weights()[bucket * OutSz * L1Sz * 2]);
+        const auto* HWY_RESTRICT l1_psqt_weights_ptr = ALIGN_PTR(int16_t, &g_network.l1_psqt_weights()[bucket * OutSz * 2]);
 
+        const auto* HWY_RESTRICT l1_biases_ptr = ALIGN_PTR(int32_t, &g_network.l1_biases()[bucket * L1Sz]);
+        const auto* HWY_RESTRICT l1_psqt_bias_ptr = ALIGN_PTR(int32_t, &g_network.l1_psqt_biases()[bucket]);
 
         using D32 = ScalableTag<int32_t>;
         using D16 = ScalableTag<int16_t>;
 
-        using HalfD16 = FixedTag<int16_t, Lanes(D32{})>;
-
-        static_assert(Lanes(D32{}) == Lanes(HalfD16{}), "Lanes must be equal");
-
-
-        HWY_ALIGN std::array<int32_t, L1Sz> l1_out{};
-        std::memcpy(l1_out.data(), l1_biases_ptr, sizeof(g_l1_biases) / 8);
-        HWY_ALIGN std::array<int32_t, L2Sz> l2_out{};
-        std::memcpy(l2_out.data(), l2_biases_ptr, sizeof(g_l2_biases) / 8);
-        HWY_ALIGN int32_t l1_psqt_out = l1_psqt_bias_ptr[0];
-        HWY_ALIGN int32_t out = out_biases_ptr[0];
-
+        std::memcpy(l1_out.data(), l1_biases_ptr, L1Sz * sizeof(int32_t));
+        l1_psqt_out = l1_psqt_bias_ptr[0];
 
         for (size_t j = 0; j < OutSz; j += Lanes(D16{}) * UNROLL) {
             std::array<Vec<D16>, UNROLL> v_our_block{};
@@ -283,6 +307,109 @@ struct Accumulator
             }
             l1_psqt_out += ReduceSum(D32{}, acc);
         }
+    }
+
+    // Sparse L1. After the ReLU most of the accumulator is zero, so the non zero int16 pairs are located with a vector
+    // compare first and only their weights are accumulated. The weights are reordered once (see Network::l1_sparse_weights)
+    // so the 16 outputs of an input pair are contiguous and a pair costs one broadcast and L1Sz / lanes multiply-adds.
+    void propagate_l1_sparse(const Color view, const size_t bucket, std::array<int32_t, L1Sz>& l1_out,
+                             int32_t& l1_psqt_out) const
+    {
+        const auto* HWY_RESTRICT our_acc_ptr = ALIGN_PTR(int16_t, view == WHITE ? white_accumulator.data() : black_accumulator.data());
+        const auto* HWY_RESTRICT their_acc_ptr = ALIGN_PTR(int16_t, view == WHITE ? black_accumulator.data() : white_accumulator.data());
+
+        const auto* HWY_RESTRICT l1_weights_ptr = ALIGN_PTR(int16_t, &g_network.l1_sparse_weights()[bucket * OutSz * L1Sz * 2]);
+        const auto* HWY_RESTRICT l1_psqt_weights_ptr = ALIGN_PTR(int16_t, &g_network.l1_psqt_weights()[bucket * OutSz * 2]);
+
+        const auto* HWY_RESTRICT l1_biases_ptr = ALIGN_PTR(int32_t, &g_network.l1_biases()[bucket * L1Sz]);
+        const auto* HWY_RESTRICT l1_psqt_bias_ptr = ALIGN_PTR(int32_t, &g_network.l1_psqt_biases()[bucket]);
+
+        using D16 = ScalableTag<int16_t>;
+        using D32 = Repartition<int32_t, D16>;
+
+        static_assert(Lanes(D32{}) <= 64, "mask bits must fit in a word");
+
+        // clipped input, ours then theirs, and the indices of its non zero pairs
+        HWY_ALIGN std::array<int16_t, OutSz * 2> input;
+        std::array<uint16_t, OutSz> nnz;
+        size_t n_nnz = 0;
+
+        for (const auto [acc_ptr, offset] : {std::pair{our_acc_ptr, size_t{0}}, std::pair{their_acc_ptr, size_t{OutSz}}})
+        {
+            for (size_t j = 0; j < OutSz; j += Lanes(D16{}))
+            {
+                const Vec<D16> v = Max(Load(D16{}, &acc_ptr[j]), Zero(D16{}));
+                Store(v, D16{}, &input[offset + j]);
+
+                uint8_t bits[8] = {};
+                StoreMaskBits(D32{}, Ne(BitCast(D32{}, v), Zero(D32{})), bits);
+                uint64_t mask;
+                std::memcpy(&mask, bits, sizeof(mask));
+
+                const auto base = static_cast<uint16_t>((offset + j) / 2);
+                for (; mask; mask &= mask - 1)
+                {
+                    nnz[n_nnz++] = base + static_cast<uint16_t>(std::countr_zero(mask));
+                }
+            }
+        }
+
+        using DO32 = CappedTag<int32_t, L1Sz>;
+        using DO16 = Repartition<int16_t, DO32>;
+        static constexpr size_t n_regs = L1Sz / Lanes(DO32{});
+
+        std::array<Vec<DO32>, n_regs> acc;
+        for (size_t r = 0; r < n_regs; r++)
+        {
+            acc[r] = Load(DO32{}, &l1_biases_ptr[r * Lanes(DO32{})]);
+        }
+        int32_t psqt = l1_psqt_bias_ptr[0];
+
+        for (size_t k = 0; k < n_nnz; k++)
+        {
+            const size_t p = nnz[k];
+
+            int32_t pair;
+            std::memcpy(&pair, &input[2 * p], sizeof(pair));
+            const Vec<DO16> x = BitCast(DO16{}, Set(DO32{}, pair));
+
+            const auto* HWY_RESTRICT w = &l1_weights_ptr[p * L1Sz * 2];
+            for (size_t r = 0; r < n_regs; r++)
+            {
+                acc[r] = Add(acc[r], WidenMulPairwiseAdd(DO32{}, x, Load(DO16{}, &w[r * Lanes(DO16{})])));
+            }
+            psqt += input[2 * p] * l1_psqt_weights_ptr[2 * p] + input[2 * p + 1] * l1_psqt_weights_ptr[2 * p + 1];
+        }
+
+        for (size_t r = 0; r < n_regs; r++)
+        {
+            Store(acc[r], DO32{}, &l1_out[r * Lanes(DO32{})]);
+        }
+        l1_psqt_out = psqt;
+    }
+
+    // L1 activation, L2, output and the psqt term, shared by both L1 paths
+    [[nodiscard]] int32_t propagate_output(const Color view, const size_t bucket, std::array<int32_t, L1Sz>& l1_out,
+                                           int32_t l1_psqt_out) const
+    {
+        const auto* HWY_RESTRICT our_psqt_ptr = ALIGN_PTR(int16_t, view == WHITE ? white_psqt.data() : black_psqt.data());
+        const auto* HWY_RESTRICT their_psqt_ptr = ALIGN_PTR(int16_t, view == WHITE ? black_psqt.data() : white_psqt.data());
+
+        const auto* HWY_RESTRICT l2_weights_ptr = ALIGN_PTR(int16_t, &g_network.l2_weights()[bucket * L1Sz * L2Sz]);
+        const auto* HWY_RESTRICT out_weights_ptr = ALIGN_PTR(int16_t, &g_network.out_weights()[bucket * L2Sz]);
+
+        const auto* HWY_RESTRICT l2_biases_ptr = ALIGN_PTR(int32_t, &g_network.l2_biases()[bucket * L2Sz]);
+        const auto* HWY_RESTRICT out_biases_ptr = ALIGN_PTR(int32_t, &g_network.out_bias()[bucket]);
+
+        using D32 = ScalableTag<int32_t>;
+        using HalfD16 = FixedTag<int16_t, Lanes(D32{})>;
+
+        static_assert(Lanes(D32{}) == Lanes(HalfD16{}), "Lanes must be equal");
+
+        HWY_ALIGN std::array<int32_t, L2Sz> l2_out{};
+        std::memcpy(l2_out.data(), l2_biases_ptr, L2Sz * sizeof(int32_t));
+        HWY_ALIGN int32_t out = out_biases_ptr[0];
+
         l1_psqt_out >>= 16;
 
 
@@ -329,17 +456,38 @@ struct Accumulator
         return out + l1_psqt_out + psqt_acc;
     }
 
-  private:
-    void update(const Accumulator& prev, const Position& pos_cur, const Position& pos_prev, const Color view)
+  public:
+    // one move on top of prev for a perspective whose king did not move
+    void update(const Accumulator& prev, const Move move, const Piece moved, const Piece captured, const Square ksq,
+                const Color view, const size_t bucket)
     {
-        const bool needs_refresh = FeatureTransformer::needs_refresh(pos_cur, pos_prev, view);
-        const auto [add, rem]    = FeatureTransformer::get_features(pos_cur, pos_prev, view, needs_refresh);
-        if (needs_refresh)
-            refresh_acc(view, add);
+        const auto [add, rem] = FeatureTransformer::get_features(move, moved, captured, ksq, view);
+        update_acc(view == WHITE ? prev.white_accumulator : prev.black_accumulator,
+                   view == WHITE ? prev.white_psqt : prev.black_psqt, view, add, rem);
+        m_bucket = bucket;
+    }
+
+    // one perspective from scratch, through the cache when there is one
+    void refresh(const Position& pos, const Color view, AccumulatorCache* cache = nullptr)
+    {
+        if (cache)
+        {
+            refresh_cached(*cache, pos, view);
+        }
         else
-            update_acc(prev, view, add, rem);
+        {
+            const auto [add, rem] = FeatureTransformer::get_features(pos, view);
+            refresh_acc(view, add);
+        }
+        m_bucket = bucket(pos);
     }
 
+    [[nodiscard]] static size_t bucket(const Position& pos) { return (pos.occupancy().popcount() - 1) / 4; }
+
+  private:
+    void refresh_cached(AccumulatorCache& cache, const Position& pos, Color view);
+
+
     template <size_t UNROLL = 8>
     void refresh_acc(const Color view, const FeatureTransformer::RetT& features)
     {
@@ -347,8 +495,8 @@ struct Accumulator
         auto& psqt_acc = (view == WHITE ? white_psqt : black_psqt);
 
 
-        std::memcpy(acc.data(), g_ft_biases, OutSz * sizeof(int16_t));
-        std::memcpy(psqt_acc.data(), g_psqt_biases, PsqtOutSz * sizeof(int16_t));
+        std::memcpy(acc.data(), g_network.ft_biases(), OutSz * sizeof(int16_t));
+        std::memcpy(psqt_acc.data(), g_network.psqt_biases(), PsqtOutSz * sizeof(int16_t));
 
         using D                         = ScalableTag<int16_t>;
         alignas(64) auto v_accumulators = std::array<decltype(Load(D{}, acc.data())), UNROLL>{};
@@ -369,7 +517,7 @@ struct Accumulator
                 {
                     if (i + u * Lanes(D{}) < OutSz)
                     {
-                        auto v_weights    = Load(D{}, &g_ft_weights[f * OutSz + i + u * Lanes(D{})]);
+                        auto v_weights    = Load(D{}, &g_network.ft_weights()[f * OutSz + i + u * Lanes(D{})]);
                         v_accumulators[u] = Add(v_accumulators[u], v_weights);
                     }
                 }
@@ -386,19 +534,17 @@ struct Accumulator
         {
             for (int j = 0; j < PsqtOutSz; j++)
             {
-                psqt_acc[j] += g_psqt_weights[f * PsqtOutSz + j];
+                psqt_acc[j] += g_network.psqt_weights()[f * PsqtOutSz + j];
             }
         }
     }
 
     template <size_t UNROLL = 8>
-    void update_acc(const Accumulator& previous, const Color view, const FeatureTransformer::RetT& add,
-                    const FeatureTransformer::RetT& sub)
+    void update_acc(const AccumulatorT& prev, const PsqtT& prev_psqt_acc, const Color view,
+                    const FeatureTransformer::RetT& add, const FeatureTransformer::RetT& sub)
     {
         auto& acc  = (view == WHITE ? white_accumulator : black_accumulator);
-        auto& prev = (view == WHITE ? previous.white_accumulator : previous.black_accumulator);
         auto& psqt_acc = (view == WHITE ? white_psqt : black_psqt);
-        auto& prev_psqt_acc = (view == WHITE ? previous.white_psqt : previous.black_psqt);
 
 
         std::memcpy(acc.data(), prev.data(), OutSz * sizeof(int16_t));
@@ -424,7 +570,7 @@ struct Accumulator
                 {
                     if (i + u * Lanes(D{}) < OutSz)
                     {
-                        auto v_weights    = Load(D{}, &g_ft_weights[f * OutSz + i + u * Lanes(D{})]);
+                        auto v_weights    = Load(D{}, &g_network.ft_weights()[f * OutSz + i + u * Lanes(D{})]);
                         v_accumulators[u] = Add(v_accumulators[u], v_weights);
                     }
                 }
@@ -436,7 +582,7 @@ struct Accumulator
                 {
                     if (i + u * Lanes(D{}) < OutSz)
                     {
-                        auto v_weights    = Load(D{}, &g_ft_weights[f * OutSz + i + u * Lanes(D{})]);
+                        auto v_weights    = Load(D{}, &g_network.ft_weights()[f * OutSz + i + u * Lanes(D{})]);
                         v_accumulators[u] = Sub(v_accumulators[u], v_weights);
                     }
                 }
@@ -452,23 +598,84 @@ struct Accumulator
         {
             for (int j = 0; j < PsqtOutSz; j++)
             {
-                psqt_acc[j] += g_psqt_weights[f * PsqtOutSz + j];
+                psqt_acc[j] += g_network.psqt_weights()[f * PsqtOutSz + j];
             }
         }
         for (const auto f : sub)
         {
             for (int j = 0; j < PsqtOutSz; j++)
             {
-                psqt_acc[j] -= g_psqt_weights[f * PsqtOutSz + j];
+                psqt_acc[j] -= g_network.psqt_weights()[f * PsqtOutSz + j];
             }
         }
     }
 };
 
+// Finny table, one per search thread. For every perspective and king square it keeps the accumulator of the last
+// position refreshed there together with its pieces, so a king move only applies the difference with that position
+// instead of adding every piece on the board. Entries start as the empty board (biases only).
+struct AccumulatorCache
+{
+    struct Entry
+    {
+        HWY_ALIGN Accumulator::AccumulatorT acc{};
+        HWY_ALIGN Accumulator::PsqtT        psqt{};
+        EnumArray<Piece, Bitboard>          pieces{};
+    };
+
+    AccumulatorCache() { clear(); }
+
+    void clear()
+    {
+        for (const auto c : {WHITE, BLACK})
+        {
+            for (auto& e : m_entries[c])
+            {
+                std::memcpy(e.acc.data(), g_network.ft_biases(), sizeof(e.acc));
+                std::memcpy(e.psqt.data(), g_network.psqt_biases(), sizeof(e.psqt));
+                e.pieces = {};
+            }
+        }
+        m_generation = g_network.generation();
+    }
+
+    // entries hold accumulated weights, they are worthless once another network is loaded
+    [[nodiscard]] bool stale() const { return m_generation != g_network.generation(); }
+
+    Entry& at(const Color view, const Square ksq) { return m_entries[view][ksq]; }
+
+  private:
+    EnumArray<Color, EnumArray<Square, Entry>> m_entries{};
+    uint64_t                                   m_generation{};
+};
+
+inline void Accumulator::refresh_cached(AccumulatorCache& cache, const Position& pos, const Color view)
+{
+    auto& entry = cache.at(view, pos.ksq(view));
+
+    const auto [add, rem] = FeatureTransformer::get_features(pos, entry.pieces, view);
+    update_acc(entry.acc, entry.psqt, view, add, rem);
+
+    entry.acc  = view == WHITE ? white_accumulator : black_accumulator;
+    entry.psqt = view == WHITE ? white_psqt : black_psqt;
+    for (const auto c : {WHITE, BLACK})
+    {
+        for (const auto pt : {PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING})
+        {
+            entry.pieces[Piece{c, pt}] = pos.occupancy(c, pt);
+        }
+    }
+}
+
 #undef ALIGN_PTR
 
 HWY_AFTER_NAMESPACE();
 
+// Lazy accumulator stack. do_move only records the move, the 1024 wide vectors of a perspective are computed on the
+// first evaluate() that needs them, starting from the closest ancestor that is already computed. When the king of
+// that perspective moved on the way it is refreshed straight from the current position instead.
+// Pruned nodes that never evaluate cost nothing.
+// The position is made and unmade in place by the search, it is the same object for every entry and outlives the stack.
 struct Accumulators
 {
     using Acc         = Accumulator;
@@ -477,26 +684,127 @@ struct Accumulators
     using ConstAccRef = ConstAcc&;
 
     explicit Accumulators(const Position& pos)
+        : m_accumulators(MAX_PLY + 1), m_entries(MAX_PLY + 1), m_cache(std::make_unique<AccumulatorCache>())
     {
-        m_accumulators.reserve(MAX_PLY);
-        m_accumulators.emplace_back(pos);
+        reset(pos);
     }
 
-    std::span<Acc>                    accumulators() { return m_accumulators; }
-    [[nodiscard]] std::span<ConstAcc> accumulators() const { return m_accumulators; }
+    void reset(const Position& pos)
+    {
+        if (m_cache->stale())
+            m_cache->clear();
 
-    AccRef                    last() { return m_accumulators.back(); }
-    [[nodiscard]] ConstAccRef last() const { return m_accumulators.back(); }
+        m_pos             = &pos;
+        m_top             = 0;
+        m_accumulators[0] = Accumulator(pos);
+        m_entries[0]      = Entry{Move::none(), NO_PIECE, NO_PIECE, 0, {true, true}};
+    }
 
-    void do_move(const Position& prev, const Position& next)
+    AccRef last()
     {
-        m_accumulators.emplace_back(m_accumulators.back(), next, prev);
+        materialize(WHITE);
+        materialize(BLACK);
+        return m_accumulators[m_top];
     }
 
-    void undo_move() { m_accumulators.pop_back(); }
+    // pos is the position once the move is made. Null moves are not pushed, they do not change any feature
+    void do_move(const Position& pos)
+    {
+        assert(m_top + 1 < m_entries.size());
+        m_pos              = &pos;
+        m_entries[++m_top] = Entry{pos.move(), pos.moved(), pos.captured(), Accumulator::bucket(pos), {false, false}};
+    }
+
+    void undo_move()
+    {
+        assert(m_top > 0);
+        --m_top;
+    }
 
   private:
+    struct Entry
+    {
+        Move                   move{};
+        Piece                  moved{};
+        Piece                  captured{};
+        size_t                 bucket{};
+        EnumArray<Color, bool> computed{};
+
+        [[nodiscard]] bool king_moved(const Color view) const { return moved == Piece{view, KING}; }
+    };
+
+    void materialize(const Color view)
+    {
+        if (m_entries[m_top].computed[view])
+            return;
+
+        // walk back to a computed entry, or to the king move after which everything has to be refreshed anyway
+        size_t start = m_top;
+        while (!m_entries[start].king_moved(view) && !m_entries[start - 1].computed[view])
+        {
+            --start;
+        }
+
+        if (m_entries[start].king_moved(view))
+        {
+            m_accumulators[m_top].refresh(*m_pos, view, m_cache.get());
+            m_entries[m_top].computed[view] = true;
+            return;
+        }
+
+        // the king did not move since start, its square is the current one
+        const Square ksq = m_pos->ksq(view);
+        for (size_t i = start; i <= m_top; i++)
+        {
+            const Entry& e = m_entries[i];
+            m_accumulators[i].update(m_accumulators[i - 1], e.move, e.moved, e.captured, ksq, view, e.bucket);
+            m_entries[i].computed[view] = true;
+        }
+    }
+
     std::vector<Accumulator> m_accumulators{};
+    std::vector<Entry>       m_entries{};
+    size_t                   m_top{};
+    const Position*          m_pos{};
+
+    std::unique_ptr<AccumulatorCache> m_cache;
+};
+
+// Network outputs of the last positions a search thread evaluated, keyed by hash. Transpositions and re-searches
+// come back to the same positions all the time, a hit skips the whole forward pass.
+class EvalCache
+{
+  public:
+    [[nodiscard]] std::optional<int32_t> probe(const hash_t hash)
+    {
+        if (m_generation != g_network.generation())
+        {
+            m_entries.fill({});
+            m_generation = g_network.generation();
+        }
+
+        const Entry& e = m_entries[hash & (N_ENTRIES - 1)];
+        if (e.key != hash || !e.valid)
+            return std::nullopt;
+        return e.eval;
+    }
+
+    void store(const hash_t hash, const int32_t eval) { m_entries[hash & (N_ENTRIES - 1)] = Entry{hash, eval, true}; }
+
+    void prefetch(const hash_t hash) const noexcept { __builtin_prefetch(&m_entries[hash & (N_ENTRIES - 1)], 0, 3); }
+
+  private:
+    struct Entry
+    {
+        hash_t  key{};
+        int32_t eval{};
+        bool    valid{};
+    };
+
+    static constexpr size_t N_ENTRIES = 1 << 14;
+
+    std::array<Entry, N_ENTRIES> m_entries{};
+    uint64_t                     m_generation{};
 };
 
 #endif
\ No newline at end of file
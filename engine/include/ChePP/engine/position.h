@@ -4,6 +4,7 @@
 #include "types.h"
 #include "zobrist.h"
 
+#include <array>
 #include <bit>
 #include <cmath>
 #include <cstring>
@@ -15,6 +16,22 @@
 #include <unordered_map>
 #include <utility>
 
+// What Position::undo_move puts back. The pieces are moved back using the move stored in the position itself, the
+// rest is the state before the move: the last move fields of the previous position and the checkers and blockers
+// of the side to move, which are the only ones kept up to date
+struct UndoInfo
+{
+    zobrist_t      hash{};
+    CastlingRights crs{};
+    Square         ep_square{};
+    uint8_t        halfmove_clock{};
+    Piece          captured{};
+    Move           move{};
+    Piece          moved{};
+    Bitboard       blockers{};
+    Bitboard       check_mask{};
+};
+
 struct Position
 {
     Position() = default;
@@ -62,10 +79,17 @@ struct Position
     [[nodiscard]] bool     is_attacking_sq(Square sq, Color c) const;
 
 
+    template <Color c>
+    [[nodiscard]] bool is_pseudo_legal(Move move) const;
+    [[nodiscard]] bool is_pseudo_legal(Move move) const;
     template <Color c>
     [[nodiscard]] bool is_legal(Move move) const;
     [[nodiscard]] bool is_legal(Move move) const;
     void               do_move(Move move);
+    void               do_move(Move move, UndoInfo& undo);
+    void               undo_move(const UndoInfo& undo);
+    // the hash after move, from zobrist deltas only, the child is never built
+    [[nodiscard]] hash_t key_after(Move move) const;
 
 
     template <PieceType pt>
@@ -87,10 +111,15 @@ struct Position
 
 
     [[nodiscard]] unsigned wdl_probe() const;
-    [[nodiscard]] unsigned dtz_probe() const;
+    // fathom root probes, fill results with every legal move and its rank. False when the root is not in the tables
+    bool root_dtz_probe(TbRootMoves& results, bool has_repeated) const;
+    bool root_wdl_probe(TbRootMoves& results) const;
 
 
-    [[nodiscard]] int see(Move move) const;
+    [[nodiscard]] int  see(Move move) const;
+    // attackers is attacking_sq(move.to_sq()), so captures on the same square can share it
+    [[nodiscard]] int  see(Move move, Bitboard attackers) const;
+    [[nodiscard]] bool see_ge(Move move, int threshold) const;
     bool              is_insufficient_material() const;
 
   private:
@@ -111,7 +140,7 @@ struct Position
     Piece                          m_moved{};
     // 5 available
 
-    // recomputed
+    // recomputed, only for the side to move
     EnumArray<Color, Bitboard> m_blockers{};
     EnumArray<Color, Bitboard> m_check_mask{};
 };
@@ -243,8 +272,8 @@ inline void Position::update()
     m_global_occupancy = occupancy(WHITE) | occupancy(BLACK);
     m_ksq              = {Square{occupancy(WHITE, KING).get_lsb()}, Square{occupancy(BLACK, KING).get_lsb()}};
 
+    // the side that just moved cannot be in check and nothing looks at its pins
     update_checkers_and_blockers(side_to_move());
-    update_checkers_and_blockers(~side_to_move());
 }
 
 
@@ -433,6 +462,81 @@ inline std::string Position::to_string() const
 
 
 
+// true if the move could have come out of gen_moves in this position. Used for moves that were not generated
+// here (tt move, killers) before handing them to is_legal, which assumes a generated move
+template <Color c>
+bool Position::is_pseudo_legal(const Move move) const
+{
+    constexpr Direction up  = c == WHITE ? NORTH : SOUTH;
+    constexpr Bitboard  bb_promotion_rank{relative_rank<c, RANK_7>};
+    constexpr Bitboard  bb_second_rank{relative_rank<c, RANK_2>};
+
+    if (!move.is_ok())
+        return false;
+    // the bits above the squares are only used by promotions and castling
+    if ((move.type_of() == NORMAL || move.type_of() == EN_PASSANT) && move.promotion_type() != KNIGHT)
+        return false;
+
+    const Square from = move.from_sq();
+    const Square to   = move.to_sq();
+    const Piece  pc   = piece_at(from);
+
+    if (pc == NO_PIECE || pc.color() != c || occupancy(c).is_set(to))
+        return false;
+
+    if (move.type_of() == CASTLING)
+    {
+        const CastlingType type = move.castling_type();
+        if (type.color() != c || !castling_rights().has(type) || check_mask(c) ||
+            type.king_move() != std::pair{from, to})
+            return false;
+
+        const auto [r_from, r_to] = type.rook_move();
+        if (from_to_excl(from, r_from) & occupancy())
+            return false;
+        const Direction dir = direction_from(from, to);
+        for (auto sq = from + dir; sq != to; sq = sq + dir)
+        {
+            if (is_attacking_sq(sq, ~c))
+                return false;
+        }
+        return true;
+    }
+
+    if (pc.type() == KING)
+        return move.type_of() == NORMAL && attacks<KING>(from).is_set(to);
+
+    // only the king can answer a double check
+    if (checkers(c).popcount() > 1)
+        return false;
+
+    const Bitboard target = check_mask(c) == bb::empty() ? bb::full() : check_mask(c);
+
+    if (pc.type() != PAWN)
+        return move.type_of() == NORMAL && (attacks(pc.type(), from, occupancy()) & target).is_set(to);
+
+    if (move.type_of() == EN_PASSANT)
+        return to == ep_square() && attacks<PAWN>(from, occupancy(), c).is_set(to) &&
+               (target.is_set(to) || target.is_set(to - up));
+
+    // promotions are exactly the pawn moves from the 7th rank
+    if ((move.type_of() == PROMOTION) != bb_promotion_rank.is_set(from) || !target.is_set(to))
+        return false;
+
+    if (attacks<PAWN>(from, occupancy(), c).is_set(to))
+        return occupancy(~c).is_set(to);
+
+    return !is_occupied(to) &&
+           (to == from + up || (to == from + up + up && bb_second_rank.is_set(from) && !is_occupied(from + up)));
+}
+
+inline bool Position::is_pseudo_legal(const Move move) const
+{
+    if (side_to_move() == WHITE)
+        return is_pseudo_legal<WHITE>(move);
+    return is_pseudo_legal<BLACK>(move);
+}
+
 template <Color c>
 bool Position::is_legal(const Move move) const
 {
@@ -440,6 +544,11 @@ bool Position::is_legal(const Move move) const
     const auto          from_bb = Bitboard(move.from_sq());
     const auto          to_bb   = Bitboard(move.to_sq());
 
+    // the generation already took care of checks, a piece that is neither pinned nor the king can go anywhere.
+    // Only en passant can still uncover something since it removes a second piece
+    if (!(from_bb & blockers(c)) && ksq(c) != move.from_sq() && move.type_of() != EN_PASSANT)
+        return true;
+
     if (ksq(c) == move.from_sq())
     {
         // cannot move along the ray of a long range piece
@@ -597,29 +706,162 @@ inline void Position::do_move(const Move move)
     update();
 }
 
+// mirrors the hash updates of do_move
+inline hash_t Position::key_after(const Move move) const
+{
+    zobrist_t key = m_hash;
+    key.flip_color();
+
+    if (ep_square() != NO_SQUARE)
+    {
+        key.flip_ep(ep_square().file());
+    }
+
+    // a move from an empty square can come from a colliding TT entry, it has no piece to move
+    if (move == Move::null() || piece_at(move.from_sq()) == NO_PIECE)
+    {
+        return key.value();
+    }
+
+    const Square    from = move.from_sq();
+    const Square    to   = move.to_sq();
+    Piece           pc   = piece_at(from);
+    const Color     us   = pc.color();
+    const Direction up   = us == WHITE ? NORTH : SOUTH;
+
+    key.flip_castling_rights(m_crs.lost_from_move(move).mask());
+
+    if (move.type_of() == CASTLING)
+    {
+        const auto castling_type = move.castling_type();
+        auto [k_from, k_to] = castling_type.king_move();
+        auto [r_from, r_to] = castling_type.rook_move();
+        key.move_piece(Piece{us, KING}, k_from, k_to);
+        key.move_piece(Piece{us, ROOK}, r_from, r_to);
+        return key.value();
+    }
+
+    if (move.type_of() == NORMAL || move.type_of() == PROMOTION)
+    {
+        if (is_occupied(to))
+        {
+            key.flip_piece(piece_at(to), to);
+        }
+        else if (pc.type() == PAWN && to.value() - from.value() == 2 * up &&
+                 ((pseudo_attack<PAWN>(to - up, us)) & occupancy(~us)) != bb::empty())
+        {
+            key.flip_ep(from.file());
+        }
+    }
+    if (move.type_of() == EN_PASSANT)
+    {
+        key.flip_piece(Piece{~us, PAWN}, to - up);
+    }
+    if (move.type_of() == PROMOTION)
+    {
+        pc = Piece{us, move.promotion_type()};
+        key.promote_piece(us, pc.type(), from);
+    }
+    key.move_piece(pc, from, to);
+
+    return key.value();
+}
+
+inline void Position::do_move(const Move move, UndoInfo& undo)
+{
+    undo = UndoInfo{m_hash,  m_crs,   m_ep_square, m_halfmove_clock, m_captured, m_move,
+                    m_moved, m_blockers.at(side_to_move()), m_check_mask.at(side_to_move())};
+    do_move(move);
+}
+
+// takes back the last move made with do_move(move, undo), in place
+inline void Position::undo_move(const UndoInfo& undo)
+{
+    const Move move = m_move;
+    const Color us  = ~m_color;
+
+    if (move != Move::null())
+    {
+        if (move.type_of() == CASTLING)
+        {
+            auto [k_from, k_to] = move.castling_type().king_move();
+            auto [r_from, r_to] = move.castling_type().rook_move();
+
+            move_piece(k_to, k_from);
+            move_piece(r_to, r_from);
+        }
+        else
+        {
+            const Square from = move.from_sq();
+            const Square to   = move.to_sq();
+
+            move_piece(to, from);
+            if (move.type_of() == PROMOTION)
+            {
+                remove_piece(from);
+                set_piece(PAWN, us, from);
+            }
+            if (move.type_of() == EN_PASSANT)
+                set_piece(PAWN, ~us, to - (us == WHITE ? NORTH : SOUTH));
+            else if (m_captured)
+                set_piece(m_captured, to);
+        }
+    }
+
+    m_fullmove_clock -= m_color == BLACK;
+    m_color          = us;
+    m_hash           = undo.hash;
+    m_crs            = undo.crs;
+    m_ep_square      = undo.ep_square;
+    m_halfmove_clock = undo.halfmove_clock;
+    m_captured       = undo.captured;
+    m_move           = undo.move;
+    m_moved          = undo.moved;
+
+    m_global_occupancy       = occupancy(WHITE) | occupancy(BLACK);
+    m_ksq                    = {Square{occupancy(WHITE, KING).get_lsb()}, Square{occupancy(BLACK, KING).get_lsb()}};
+    m_blockers.at(m_color)   = undo.blockers;
+    m_check_mask.at(m_color) = undo.check_mask;
+}
+
 
 
 inline unsigned Position::wdl_probe() const
 {
-    size_t ep_sq = ep_square() == NO_SQUARE ? 0 : ep_square().index() + 1;
+    // Fathom takes the square index itself, 0 (a1, never an ep square) meaning none
+    size_t ep_sq = ep_square() == NO_SQUARE ? 0 : ep_square().index();
     return tb_probe_wdl(occupancy(WHITE).value(), occupancy(BLACK).value(), occupancy(KING).value(),
                         occupancy(QUEEN).value(), occupancy(ROOK).value(), occupancy(BISHOP).value(),
                         occupancy(KNIGHT).value(), occupancy(PAWN).value(), static_cast<unsigned>(halfmove_clock()),
                         castling_rights().mask(), ep_sq, side_to_move() == WHITE);
 }
 
-inline unsigned Position::dtz_probe() const
+inline bool Position::root_dtz_probe(TbRootMoves& results, const bool has_repeated) const
+{
+    size_t ep_sq = ep_square() == NO_SQUARE ? 0 : ep_square().index();
+    return tb_probe_root_dtz(occupancy(WHITE).value(), occupancy(BLACK).value(), occupancy(KING).value(),
+                             occupancy(QUEEN).value(), occupancy(ROOK).value(), occupancy(BISHOP).value(),
+                             occupancy(KNIGHT).value(), occupancy(PAWN).value(), static_cast<unsigned>(halfmove_clock()),
+                             castling_rights().mask(), ep_sq, side_to_move() == WHITE, has_repeated, true, &results);
+}
+
+inline bool Position::root_wdl_probe(TbRootMoves& results) const
 {
-    size_t ep_sq = ep_square() == NO_SQUARE ? 0 : ep_square().index() + 1;
-    return tb_probe_root(occupancy(WHITE).value(), occupancy(BLACK).value(), occupancy(KING).value(),
-                         occupancy(QUEEN).value(), occupancy(ROOK).value(), occupancy(BISHOP).value(),
-                         occupancy(KNIGHT).value(), occupancy(PAWN).value(), static_cast<unsigned>(halfmove_clock()),
-                         castling_rights().mask(), ep_sq, side_to_move() == WHITE, nullptr);
+    size_t ep_sq = ep_square() == NO_SQUARE ? 0 : ep_square().index();
+    return tb_probe_root_wdl(occupancy(WHITE).value(), occupancy(BLACK).value(), occupancy(KING).value(),
+                             occupancy(QUEEN).value(), occupancy(ROOK).value(), occupancy(BISHOP).value(),
+                             occupancy(KNIGHT).value(), occupancy(PAWN).value(), static_cast<unsigned>(halfmove_clock()),
+                             castling_rights().mask(), ep_sq, side_to_move() == WHITE, true, &results);
 }
 
 
 
 inline int Position::see(const Move move) const
+{
+    return see(move, attacking_sq(move.to_sq()));
+}
+
+inline int Position::see(const Move move, Bitboard attackers) const
 {
 
     assert(move.type_of() != CASTLING);
@@ -635,14 +877,13 @@ inline int Position::see(const Move move) const
     const Direction up    = (us == WHITE) ? NORTH : SOUTH;
     const bool      is_ep = move.type_of() == EN_PASSANT;
 
-    std::vector<int> gains;
-    gains.reserve(32);
+    // every capture takes a different piece off the board, 32 is always enough
+    std::array<int, 32> gains;
+    int                 n_gains = 0;
 
     Bitboard occ = occupancy();
     occ.unset(is_ep ? to - up : to);
 
-    auto attackers = attacking_sq(to, occ);
-
     if (attackers.is_set(ksq(WHITE)) && attackers.is_set(ksq(BLACK)))
     {
         attackers.unset(ksq(WHITE));
@@ -660,7 +901,7 @@ inline int Position::see(const Move move) const
     const Piece captured = piece_at(is_ep ? to - up : to);
 
     capture(from);
-    gains.push_back(captured ? captured.piece_value() : 0);
+    gains[n_gains++] = captured ? captured.piece_value() : 0;
     int balance = captured ? captured.piece_value() : 0;
 
     Color     side             = them;
@@ -697,15 +938,85 @@ inline int Position::see(const Move move) const
         side = ~side;
 
         balance = -balance + cur.piece_value();
-        gains.push_back(balance);
+        gains[n_gains++] = balance;
 
         cur = chosen_pt;
     }
 
-    for (int i = static_cast<int>(gains.size()) - 1; i > 0; --i)
+    for (int i = n_gains - 1; i > 0; --i)
         gains[i - 1] = std::min(-gains[i], gains[i - 1]);
 
-    return gains.empty() ? 0 : gains[0];
+    return gains[0];
+}
+
+// same exchange as see but only answers see(move) >= threshold, so it can stop as soon as one side is sure of the
+// outcome instead of playing the whole sequence out.
+// swap is what the side that just captured is sure to keep if the other side stops now, res is the answer so far
+inline bool Position::see_ge(const Move move, const int threshold) const
+{
+    assert(move.type_of() != CASTLING);
+
+    const Square from      = move.from_sq();
+    const Square to        = move.to_sq();
+    const Color  us        = color_at(from);
+    const bool   is_ep     = move.type_of() == EN_PASSANT;
+    const Square victim_sq = is_ep ? to - (us == WHITE ? NORTH : SOUTH) : to;
+    const Piece  captured  = piece_at(victim_sq);
+
+    // even if nothing recaptures we do not reach the threshold
+    int swap = (captured ? captured.piece_value() : 0) - threshold;
+    if (swap < 0)
+        return false;
+
+    // even losing the piece we moved keeps us above it
+    swap = piece_type_at(from).piece_value() - swap;
+    if (swap <= 0)
+        return true;
+
+    Bitboard occ = occupancy() & ~Bitboard(from) & ~Bitboard(victim_sq);
+    Bitboard attackers = attacking_sq(to);
+    if (attackers.is_set(ksq(WHITE)) && attackers.is_set(ksq(BLACK)))
+    {
+        attackers.unset(ksq(WHITE));
+        attackers.unset(ksq(BLACK));
+    }
+    attackers |= (attacks<ROOK>(to, occ) & occupancy(ROOK, QUEEN)) | (attacks<BISHOP>(to, occ) & occupancy(BISHOP, QUEEN));
+    attackers &= occ;
+
+    Color side = us;
+    bool  res  = true;
+    while (true)
+    {
+        side = ~side;
+
+        const Bitboard attacking = attackers & occupancy(side);
+        if (!attacking)
+            break;
+
+        PieceType chosen_pt = NO_PIECE_TYPE;
+        Bitboard  chosen_bb{};
+        for (const auto pt : PieceType::values())
+        {
+            if ((chosen_bb = occupancy(side, pt) & attacking))
+            {
+                chosen_pt = pt;
+                break;
+            }
+        }
+
+        // the king can only take if nothing can take it back
+        if (chosen_pt == KING)
+            return (attackers & occupancy(~side)) ? res : !res;
+
+        res = !res;
+        if ((swap = chosen_pt.piece_value() - swap) < res)
+            break;
+
+        occ &= ~Bitboard(Square{chosen_bb.get_lsb()});
+        attackers |= (attacks<ROOK>(to, occ) & occupancy(ROOK, QUEEN)) | (attacks<BISHOP>(to, occ) & occupancy(BISHOP, QUEEN));
+        attackers &= occ;
+    }
+    return res;
 }
 
 inline bool Position::is_insufficient_material() const
@@ -751,75 +1062,64 @@ inline bool Position::is_insufficient_material() const
 }
 
 
+// The position being searched, moves are made and unmade in place and the undo records are kept to walk back up.
+// The hashes of every position since the root (and of the game before it) are kept for the repetition checks
 struct Positions
 {
     using PosRef      = Position&;
     using ConstPosRef = const Position&;
 
-    // Moves will not be visible through the positions span
+    // Moves are the game history, they are played on the position but cannot be undone
     // They are used internally to check for repetitions
     // They do not count towards the ply limit
     explicit Positions(const Position& pos, const std::span<Move> moves = {})
     {
-        m_positions.reserve(moves.size() + MAX_PLY + 1);
-        m_hashes.reserve(MAX_PLY + 1);
-        m_positions.emplace_back(pos);
-        m_hashes.emplace_back(pos.hash(), 1);
-        for (const auto m : moves)
-        {
-            do_move(m);
-        }
-        m_start_size = m_positions.size();
+        reset(pos, moves);
     }
 
     explicit Positions(const std::string& fen, const std::span<Move> moves = {})
     {
-        m_positions.reserve(moves.size() + MAX_PLY + 1);
-        m_hashes.reserve(MAX_PLY + 1);
         Position pos;
         pos.from_fen(fen);
-        m_positions.emplace_back(pos);
+        reset(pos, moves);
+    }
+
+    // re-roots the stack on a new game, the vectors keep their capacity
+    void reset(const Position& pos, const std::span<Move> moves = {})
+    {
+        m_pos = pos;
+        m_undo.clear();
+        m_hashes.clear();
+        m_undo.reserve(MAX_PLY + 1);
+        m_hashes.reserve(moves.size() + MAX_PLY + 1);
         m_hashes.emplace_back(pos.hash(), 1);
         for (const auto m : moves)
         {
-            do_move(m);
+            m_pos.do_move(m);
+            push_hash();
         }
-        m_start_size = m_positions.size();
     }
 
-    [[nodiscard]] std::size_t ply() const { return m_positions.size() - m_start_size; }
-
-    std::span<Position>                     positions() { return {m_positions.data() + m_start_size - 1, ply() + 1}; }
-    [[nodiscard]] std::span<const Position> positions() const { return {m_positions.data() + m_start_size - 1, ply() + 1}; }
-
-    PosRef                    operator[](const std::size_t ply) { return positions()[ply]; }
-    [[nodiscard]] ConstPosRef operator[](const std::size_t ply) const { return positions()[ply]; }
-
-    PosRef                    operator()(const std::size_t ply) { return positions()[ply]; }
-    [[nodiscard]] ConstPosRef operator()(const std::size_t ply) const { return positions()[ply]; }
+    [[nodiscard]] std::size_t ply() const { return m_undo.size(); }
 
-    PosRef                    last() { return positions()[ply()]; }
-    [[nodiscard]] ConstPosRef last() const { return positions()[ply()]; }
+    PosRef                    last() { return m_pos; }
+    [[nodiscard]] ConstPosRef last() const { return m_pos; }
 
     void do_move(const Move move)
     {
         assert(ply() < MAX_PLY);
 
-        m_positions.emplace_back(m_positions.back(), move);
-
-        const auto view = m_hashes | std::views::reverse | std::views::take(last().halfmove_clock());
-        const auto it   = std::ranges::find(view, last().hash(), &std::pair<hash_t, int>::first);
-
-        int c = it != view.end() ? it->second + 1 : 1;
-        m_hashes.emplace_back(last().hash(), c);
+        m_pos.do_move(move, m_undo.emplace_back());
+        push_hash();
     }
 
     void undo_move()
     {
         assert(ply() > 0);
 
+        m_pos.undo_move(m_undo.back());
+        m_undo.pop_back();
         m_hashes.pop_back();
-        m_positions.pop_back();
     }
 
     [[nodiscard]] bool is_repetition() const
@@ -829,10 +1129,43 @@ struct Positions
         return std::ranges::any_of(view, [&](const auto h) { return h.second >= 3; });
     }
 
+    // true if a position since the last zeroing move already occurred once before, Fathom's has_repeated
+    [[nodiscard]] bool has_repeated() const
+    {
+        const auto view = m_hashes | std::views::reverse | std::views::take(last().halfmove_clock() + 1);
+        return std::ranges::any_of(view, [&](const auto h) { return h.second >= 2; });
+    }
+
+    // what is_repetition() would say once move is played, from its key alone
+    [[nodiscard]] bool is_repetition_after(const Move move) const
+    {
+        const Position& pos     = last();
+        const bool      zeroing = move != Move::null() && move.type_of() != CASTLING &&
+                             (pos.piece_type_at(move.from_sq()) == PAWN || pos.is_occupied(move.to_sq()));
+        const int halfmove = zeroing ? 0 : pos.halfmove_clock() + 1;
+        if (halfmove >= 100) return true;
+
+        // the window push_hash would look at, the child's own count comes from its latest occurrence
+        const hash_t key  = pos.key_after(move);
+        const auto   view = m_hashes | std::views::reverse | std::views::take(halfmove);
+        const auto   it   = std::ranges::find(view, key, &std::pair<hash_t, int>::first);
+        if (it != view.end() && it->second >= 2) return true;
+        return std::ranges::any_of(view, [&](const auto h) { return h.second >= 3; });
+    }
+
 private:
-    std::vector<Position>               m_positions{};
+    void push_hash()
+    {
+        const auto view = m_hashes | std::views::reverse | std::views::take(last().halfmove_clock());
+        const auto it   = std::ranges::find(view, last().hash(), &std::pair<hash_t, int>::first);
+
+        int c = it != view.end() ? it->second + 1 : 1;
+        m_hashes.emplace_back(last().hash(), c);
+    }
+
+    Position                            m_pos{};
+    std::vector<UndoInfo>               m_undo{};
     std::vector<std::pair<hash_t, int>> m_hashes{};
-    std::size_t                         m_start_size{1};
 };
 
 #endif
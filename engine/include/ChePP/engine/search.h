@@ -5,13 +5,22 @@
 #include "nnue.h"
 #include "tm.h"
 #include "tt.h"
+#include "tb.h"
 #include "history.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
 #include <thread>
 #include <unordered_map>
 #include <utility>
@@ -19,6 +28,64 @@
 
 #include "search_stack.h"
 
+struct AspirationStats {
+    double variance = 10000.0;
+    const double lambda = 0.95;
+    int z = 2;
+
+    [[nodiscard]] int window() const {
+        double sigma = std::sqrt(variance);
+        int w = int(z * sigma);
+        if (w < 8) w = 8;
+        if (w > 300) w = 300;
+        return w;
+    }
+
+    void update(int delta_eval) {
+        double d2 = double(delta_eval) * double(delta_eval);
+        variance = lambda * variance + (1.0 - lambda) * d2;
+    }
+};
+
+// A counter written by its own search thread only. The relaxed atomic is just there so the main thread can sum the
+// counters of the pool while the search runs, an increment stays a plain load and store
+class ThreadCounter
+{
+  public:
+    ThreadCounter() = default;
+    ThreadCounter(const ThreadCounter& other) : m_value(static_cast<uint64_t>(other)) {}
+    ThreadCounter& operator=(const ThreadCounter& other)
+    {
+        m_value.store(static_cast<uint64_t>(other), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void operator++(int) { m_value.store(m_value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+    operator uint64_t() const { return m_value.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> m_value{};
+};
+
+// uci score, mates are given in moves (a mate in one ply is "mate 1", being mated next ply "mate -1")
+inline std::string format_score(const int eval)
+{
+    if (eval >= MATE_IN_MAX_PLY)
+        return std::format("mate {}", (MATE - eval + 1) / 2);
+    if (eval <= MATED_IN_MAX_PLY)
+        return std::format("mate {}", (MATED - eval) / 2);
+    return std::format("cp {}", eval);
+}
+
+// the search is compiled once per node type, non pv nodes are most of the tree and skip every pv and root only branch
+enum SearchNode
+{
+    Root,
+    Pv,
+    NonPv
+};
+
 struct SearchThread
 {
     struct SearchResult
@@ -31,15 +98,35 @@ struct SearchThread
 
     struct SearchInfos
     {
-        uint64_t nodes;
-        uint64_t tt_hits;
-        uint64_t tb_hits;
+        ThreadCounter nodes;
+        ThreadCounter tt_hits;
+        ThreadCounter tb_hits;
     };
 
     explicit SearchThread(const int id, TimeManager& tm, const Position& pos, std::span<Move> moves)
         : m_thread_id(id), m_tm(tm), m_positions(pos, moves), m_accumulators(m_positions.last()), m_ss(MAX_PLY + 1), m_root_refutation_time()
     {
-        ss().pos = &m_positions.last();
+        ss().pos   = &m_positions.last();
+        ss().move  = m_positions.last().move();
+        ss().moved = m_positions.last().moved();
+    }
+
+    // threads are kept between searches, only the root changes. Histories and aspiration stats stay warm
+    void set_root(const Position& pos, const std::span<Move> moves, const MoveList& root_moves, const size_t multipv = 1)
+    {
+        m_positions.reset(pos, moves);
+        m_root_moves = root_moves;
+        m_multipv    = std::clamp<size_t>(multipv, 1, std::max<size_t>(root_moves.size(), 1));
+        m_accumulators.reset(m_positions.last());
+        m_ss.clear();
+        ss().pos   = &m_positions.last();
+        ss().move  = m_positions.last().move();
+        ss().moved = m_positions.last().moved();
+
+        m_infos = {};
+        m_root_refutation_time.clear();
+        bestMove = Move{};
+        m_result = SearchResult{};
     }
 
     int          m_thread_id;
@@ -49,13 +136,38 @@ struct SearchThread
     Accumulators                       m_accumulators;
     SearchStack                        m_ss;
 
+    // legal root moves, only the ones keeping the best result when the root is in the tablebases
+    MoveList m_root_moves{};
+
+    // MultiPV, one line per pv index, best first once an iteration is done. Line i is searched with the first moves
+    // of lines 0 to i-1 left out of the root
+    struct RootLine
+    {
+        int               score{};
+        std::vector<Move> pv{};
+    };
+    std::vector<RootLine> m_lines{};
+    size_t                m_multipv{1};
+    size_t                m_pv_idx{0};
+
     SearchInfos    m_infos{};
     HistoryManager m_history{};
+    int            m_seldepth{};
+
+    // every thread of the search, this one included, set by the handler
+    std::span<const std::unique_ptr<SearchThread>> m_pool{};
+    WdlCache       m_wdl_cache{};
+    EvalCache      m_eval_cache{};
 
     std::unordered_map<uint16_t, std::size_t> m_root_refutation_time;
 
     Move bestMove;
 
+    // last fully searched iteration, used by the handler to pick the move across threads
+    SearchResult   m_result{};
+    // one window per pv index, the deltas of different root lines are not mixed
+    std::vector<AspirationStats> m_asp_stats{};
+
 
     [[nodiscard]] int ply() const { return static_cast<int>(m_positions.ply()); }
     [[nodiscard]] SearchStack::Node& ss() { return m_ss[ply()]; }
@@ -63,9 +175,16 @@ struct SearchThread
     template <bool UpdateNNUE = true>
     void do_move(const Move move)
     {
+        // the child's TT bucket and eval cache slot are fetched while the move is made
+        const hash_t key = m_positions.last().key_after(move);
+        g_tt.prefetch(key);
+        m_eval_cache.prefetch(key);
+
         m_positions.do_move(move);
-        if constexpr (UpdateNNUE) m_accumulators.do_move(m_positions[ply() - 1], m_positions.last());
-        ss().pos = &m_positions.last();
+        if constexpr (UpdateNNUE) m_accumulators.do_move(m_positions.last());
+        ss().pos   = &m_positions.last();
+        ss().move  = move;
+        ss().moved = m_positions.last().moved();
     }
 
     template <bool UpdateNNUE = true>
@@ -76,56 +195,113 @@ struct SearchThread
         if constexpr (UpdateNNUE) m_accumulators.undo_move();
     }
 
-    int32_t evaluate()
+    // network output kept off the tablebase scores, what the TT and the eval cache store
+    int32_t raw_eval()
     {
-        auto eval = m_accumulators.last().evaluate(m_positions.last().side_to_move());
-        eval      = std::clamp(eval, LOSS_TB + 1, WIN_TB - 1);
-        eval -= eval * m_positions.last().halfmove_clock() / 101;
+        const Position& pos = m_positions.last();
+        if (const auto cached = m_eval_cache.probe(pos.hash()))
+            return *cached;
+
+        const int32_t eval = std::clamp(m_accumulators.last().evaluate(pos.side_to_move()), LOSS_TB + 1, WIN_TB - 1);
+        m_eval_cache.store(pos.hash(), eval);
         return eval;
     }
 
-    [[nodiscard]] bool is_draw() const { return m_positions.is_repetition() || m_positions.last().is_insufficient_material(); }
+    // the fifty move counter is not part of the hash, it is applied on top of the raw eval
+    [[nodiscard]] int32_t adjust_eval(const int32_t raw) const
+    {
+        return raw - raw * m_positions.last().halfmove_clock() / 101;
+    }
 
-    std::span<const Position> positions() { return m_positions.positions(); }
+    int32_t evaluate() { return adjust_eval(raw_eval()); }
 
-    SearchResult IterativeDeepening();
-    int  AspirationWindow(int depth, int prev_eval);
-    int  Negamax(int depth, int alpha, int beta);
-    int  QSearch(int alpha, int beta);
-};
+    [[nodiscard]] bool is_draw() const { return m_positions.is_repetition() || m_positions.last().is_insufficient_material(); }
 
-inline std::vector<Move> get_pv_line(const Position& pos, int max_depth = MAX_PLY)
-{
-    std::vector<Move> pv;
-    Position          temp_pos = pos;
+    // engine wide count, summed over the pool on demand
+    [[nodiscard]] uint64_t pool_sum(ThreadCounter SearchInfos::*counter) const
+    {
+        if (m_pool.empty())
+            return m_infos.*counter;
 
-    for (int ply = 0; ply < max_depth; ++ply)
+        uint64_t sum = 0;
+        for (const auto& t : m_pool)
+            sum += t->m_infos.*counter;
+        return sum;
+    }
+
+    // main thread only. The clock is looked at every 4096 nodes. A node budget is checked on every node when there
+    // is a single thread, so a given budget always stops at the same node, the helpers are only summed now and then
+    void check_limits()
     {
-        const auto tt_hit = g_tt.probe(temp_pos.hash());
-        if (!tt_hit || tt_hit->m_move == Move::none())
-            break;
+        if (m_thread_id != 0)
+            return;
 
-        pv.push_back(tt_hit->m_move);
-        temp_pos.do_move(tt_hit->m_move);
+        if (m_infos.nodes % 4096 == 0)
+            m_tm.update_time();
 
-        if (gen_legal(temp_pos).empty())
-            break;
+        const uint64_t limit = m_tm.node_limit();
+        if (limit && (m_pool.size() <= 1 || m_infos.nodes % 1024 == 0) && !m_tm.on_hold() &&
+            pool_sum(&SearchInfos::nodes) >= limit)
+            m_tm.stop();
     }
 
-    return pv;
-}
+    [[nodiscard]] bool in_earlier_line(const Move m) const
+    {
+        return std::ranges::any_of(m_lines | std::views::take(m_pv_idx),
+                                   [&](const RootLine& l) { return !l.pv.empty() && l.pv.front() == m; });
+    }
 
-inline std::string format_pv_line(const Position& pos, const int depth)
-{
-    std::ostringstream oss;
-    auto pv = get_pv_line(pos, depth);
-    for (auto m : pv)
+    // what the main thread reports after each iteration, one line per pv with the moves collected by the search
+    void send_info(const int depth) const
     {
-        oss << m << " ";
+        const uint64_t nodes = pool_sum(&SearchInfos::nodes);
+        const int64_t  time  = m_tm.elapsed_ms();
+
+        for (size_t i = 0; i < m_lines.size(); i++)
+        {
+            std::string pv;
+            for (const Move m : m_lines[i].pv)
+            {
+                pv += m.to_string();
+                pv += ' ';
+            }
+
+            std::cout << std::format(
+                             "info depth {} seldepth {} multipv {} score {} nodes {} nps {} hashfull {} tbhits {} time {} pv {}",
+                             depth, m_seldepth, i + 1, format_score(m_lines[i].score), nodes,
+                             nodes * 1000 / std::max<int64_t>(time, 1), g_tt.hashfull(),
+                             pool_sum(&SearchInfos::tb_hits), time, pv)
+                      << std::endl;
+        }
     }
-    oss << std::endl;
-    return oss.str();
-}
+
+    // tablebase score of the current position when it is worth probing, through the thread's WDL cache
+    std::optional<int> probe_wdl(const int depth)
+    {
+        const Position& pos = m_positions.last();
+        if (!WdlCache::should_probe(pos, depth))
+            return std::nullopt;
+
+        const unsigned wdl = m_wdl_cache.probe(pos);
+        if (wdl == TB_RESULT_FAILED)
+            return std::nullopt;
+
+        m_infos.tb_hits++;
+        switch (wdl)
+        {
+            case TB_LOSS: return LOSS_TB + ply();
+            case TB_WIN:  return WIN_TB - ply();
+            default:      return 0;
+        }
+    }
+
+    SearchResult IterativeDeepening();
+    int  AspirationWindow(int depth, int prev_eval);
+    template <SearchNode node>
+    int  Negamax(int depth, int alpha, int beta);
+    template <SearchNode node>
+    int  QSearch(int alpha, int beta);
+};
 
 inline const std::array<std::array<int, 256>, MAX_PLY>& lmr_table(bool quiet)
 {
@@ -191,82 +367,82 @@ inline int futility_margin_for_depth(int depth)
 
 inline SearchThread::SearchResult SearchThread::IterativeDeepening()
 {
-    int prev_eval = evaluate();
+    m_lines.assign(m_multipv, RootLine{evaluate(), {}});
+    m_asp_stats.resize(m_multipv);
 
-    SearchResult ret;
+    // Lazy SMP, helpers skip some depths so the threads are spread over several iterations instead of all
+    // searching the same tree. Thread i uses a skip size / phase pair, they repeat after 20 threads
+    static constexpr std::array<int, 20> skip_size  = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+    static constexpr std::array<int, 20> skip_phase = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
 
-    int depth = 1;
-    for (; m_tm.update_depth(depth), !m_tm.should_stop(); ++depth)
+    m_result = SearchResult{};
+    bool first_line_aborted = false;
+
+    for (int depth = 1; !m_tm.should_stop(); ++depth)
     {
-        const auto eval = AspirationWindow(depth, prev_eval);
-        if (!m_tm.should_stop())
+        // only the main thread ends the search on the depth limit, a helper ahead of it just stops by itself
+        if (m_thread_id == 0)
+            m_tm.update_depth(depth);
+        else if (m_tm.depth_exceeded(depth))
+            break;
+        if (m_tm.should_stop())
+            break;
+
+        if (m_thread_id > 0 && depth > 1)
         {
-            prev_eval = eval;
+            const int i = (m_thread_id - 1) % 20;
+            if ((depth + skip_phase[i]) / skip_size[i] % 2)
+                continue;
+        }
 
-            if (m_thread_id == 0)
+        // each line gets its own aspiration window around its previous score
+        m_seldepth = 0;
+        // only what the first line of this iteration finds, for when it gets aborted
+        bestMove = Move::none();
+        for (m_pv_idx = 0; m_pv_idx < m_multipv; m_pv_idx++)
+        {
+            const int eval = AspirationWindow(depth, m_lines[m_pv_idx].score);
+            if (m_tm.should_stop())
             {
-                std::string score;
-                if (eval >= MATE_IN_MAX_PLY)
-                {
-                    score.append("mate ");
-                    score.append(std::to_string((MATE - eval) / 2));
-                }
-                else if (eval <= MATED_IN_MAX_PLY)
-                {
-                    score.append("mate ");
-                    score.append(std::to_string((MATED - eval) / 2));
-                }
-                else
-                {
-                    score.append("cp ");
-                    score.append(std::to_string(eval));
-                }
-
-                std::string uci_output = std::format(
-                    "info score {} depth {} nodes {} tb_hits {} pv {}",
-                    score, depth, m_infos.nodes, m_infos.tb_hits,
-                    format_pv_line(m_positions.last(), depth)
-                );
-                std::cout << uci_output << std::flush;
+                first_line_aborted = m_pv_idx == 0;
+                break;
             }
-        }
-    }
 
-    ret.depth = depth - 1;
-    ret.best_move = bestMove;
-    ret.full_search = false;
-    ret.score = prev_eval;
-    return ret;
-}
+            const auto& root = m_ss[0];
+            m_lines[m_pv_idx] = RootLine{eval, {root.pv.begin(), root.pv.begin() + root.pv_length}};
+        }
+        if (m_tm.should_stop())
+            break;
 
-struct AspirationStats {
-    double variance = 10000.0;
-    const double lambda = 0.95;
-    int z = 2;
+        // a later line may have come out better than an earlier one
+        std::ranges::stable_sort(m_lines, std::greater{}, &RootLine::score);
+        m_result = SearchResult{m_lines[0].score, depth, m_lines[0].pv.empty() ? bestMove : m_lines[0].pv[0], true};
 
-    [[nodiscard]] int window() const {
-        double sigma = std::sqrt(variance);
-        int w = int(z * sigma);
-        if (w < 8) w = 8;
-        if (w > 300) w = 300;
-        return w;
+        if (m_thread_id == 0)
+            send_info(depth);
     }
 
-    void update(int delta_eval) {
-        double d2 = double(delta_eval) * double(delta_eval);
-        variance = lambda * variance + (1.0 - lambda) * d2;
-    }
-};
+    // an iteration aborted during its first line may still have improved the root move, keep it but not its score.
+    // Otherwise the sorted lines of the last iteration decide
+    if (first_line_aborted && bestMove != Move::none() && bestMove != Move::null())
+        m_result.best_move = bestMove;
+
+    // the main thread going down ends the search for everyone
+    if (m_thread_id == 0)
+        m_tm.stop();
+
+    return m_result;
+}
 
 inline int SearchThread::AspirationWindow(const int depth, const int prev_eval)
 {
-    static AspirationStats stats;
+    auto& stats = m_asp_stats[m_pv_idx];
     int alpha, beta;
 
     if (depth <= 7) {
         alpha = -INF_SCORE;
         beta  = +INF_SCORE;
-        auto eval = Negamax(depth, alpha, beta);
+        auto eval = Negamax<Root>(depth, alpha, beta);
 
         if (depth > 1) {
             stats.update(eval - prev_eval);
@@ -280,7 +456,7 @@ inline int SearchThread::AspirationWindow(const int depth, const int prev_eval)
     alpha = prev_eval - window;
     beta  = prev_eval + window;
 
-    auto eval = Negamax(depth, alpha, beta);
+    auto eval = Negamax<Root>(depth, alpha, beta);
 
     while (eval <= alpha || eval >= beta) {
         if (m_tm.should_stop())
@@ -290,7 +466,7 @@ inline int SearchThread::AspirationWindow(const int depth, const int prev_eval)
         alpha = std::clamp(eval - window, -INF_SCORE, INF_SCORE);
         beta  = std::clamp(eval + window, -INF_SCORE, INF_SCORE);
 
-        eval = Negamax(depth, alpha, beta);
+        eval = Negamax<Root>(depth, alpha, beta);
     }
 
     stats.update(eval - prev_eval);
@@ -318,33 +494,27 @@ inline auto read_tt_score(const int score, const int ply)
     return score;
 };
 
-enum SearchNode
-{
-    Pv,
-    Cut,
-    All
-};
-
-inline int SearchThread::Negamax(int depth, int alpha, int beta)
+template <SearchNode node>
+int SearchThread::Negamax(int depth, int alpha, int beta)
 {
+    constexpr bool is_root = node == Root;
+    constexpr bool is_pv   = node != NonPv;
 
-    if (m_thread_id == 0 && m_infos.nodes % 4096 == 0)
-    {
-        TimeManager::UpdateInfo info{};
-        m_tm.update_time();
-    }
+    check_limits();
+    ss().clear_pv();
+    m_seldepth = std::max(m_seldepth, ply());
     const Position&        pos = m_positions.last();
 
     const int  alpha_org = alpha;
-    const bool is_root   = ply() == 0;
     const bool in_check  = pos.checkers(pos.side_to_move()).value();
 
     assert(depth >= 0);
+    assert(is_root == (ply() == 0));
 
 
 
     if (depth <= 0)
-        return QSearch(alpha, beta);
+        return QSearch<is_pv ? Pv : NonPv>(alpha, beta);
 
 
 
@@ -355,7 +525,7 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
 
     m_infos.nodes++;
 
-    if (!is_root)
+    if constexpr (!is_root)
     {
         if (is_draw())
         {
@@ -383,19 +553,14 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
         depth++;
     }
 
-
-    const bool is_pv = beta - alpha > 1;
-
     // try to use the TT
     auto tt_hit = ss().excluded ? std::nullopt : g_tt.probe(pos.hash());
-    if (tt_hit)
-    {
-        do_move<false>(tt_hit->m_move);
-        if (is_draw())
-            tt_hit = std::nullopt;
-        undo_move<false>();
-
-    }
+    // the key check only has 16 bits, an entry whose move can't be played here was stored by another position
+    if (tt_hit && !pos.is_pseudo_legal(tt_hit->m_move))
+        tt_hit = std::nullopt;
+    // an entry whose move repeats is not trusted, its score was found on another path
+    if (tt_hit && m_positions.is_repetition_after(tt_hit->m_move))
+        tt_hit = std::nullopt;
     if (!is_pv && tt_hit)
     {
         const tt_entry_t& e = *tt_hit;
@@ -420,76 +585,23 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
 
 
 
-    if (!is_root && pos.occupancy().popcount() <= 7) {
-        auto wdl = pos.wdl_probe();
-        if (wdl != TB_RESULT_FAILED) {
-            m_infos.tb_hits++;
-
-            int score;
-            switch (wdl) {
-                case TB_LOSS: score = LOSS_TB + ply(); break;
-                case TB_DRAW: case TB_BLESSED_LOSS: case TB_CURSED_WIN: score = 0; break;
-                case TB_WIN:  score = WIN_TB - ply(); break;
-                default:          score = 0;
-            }
-
-            return score;
-        }
-    }
-
-    if (false && is_root && pos.occupancy().popcount() <= 7) {
-        auto res = pos.dtz_probe();
-        if (res != TB_RESULT_FAILED) {
-            m_infos.tb_hits++;
-
-            switch (res) {
-                case TB_LOSS: break;
-                case TB_DRAW: break;
-                case TB_WIN:
-                {
-                    Square from{TB_GET_FROM(res)};
-                    Square to{TB_GET_TO(res)};
-                    Square ep{TB_GET_EP(res)};
-                    Piece promote{TB_GET_PROMOTES(res)};
-
-                    break;
-                }
-
-                default: break;
-            }
-
-        }
+    if constexpr (!is_root)
+    {
+        if (const auto tb_score = probe_wdl(depth))
+            return *tb_score;
     }
 
-
-
-
-
-    int static_eval = in_check? 0 : tt_hit ? tt_hit->m_score : evaluate();
+    // the TT entry carries the raw eval of its position, the network only runs on a miss of both caches
+    const int raw_static_eval = in_check ? 0 : tt_hit ? tt_hit->m_eval : raw_eval();
+    const int static_eval     = in_check ? 0 : adjust_eval(raw_static_eval);
     assert(static_eval > -INF);
 
     ss().eval = static_eval;
 
     // the improving heuristic, basically checks if the sequence of moves improves the position
     // used to be more cautious of fail low, less cautious of fail highs in futility prunings
-    bool is_improving;
-
-    if (in_check)
-    {
-        is_improving = false;
-    }
-    else if (ply() >= 4)
-    {
-        is_improving = ss().prev()->prev()->prev()->prev()->eval > static_eval;
-    }
-    else if (ply() >=2 )
-    {
-        is_improving = ss().prev()->prev()->eval > static_eval;
-    }
-    else
-    {
-        is_improving = true;
-    }
+    // the sentinels before the root never count against it
+    const bool is_improving = !in_check && ss().prev(4)->eval > static_eval;
 
     // testing reverse futility pruning, basically if the evaluation is already crazy high, just fail high the node
     // need to be careful though because can give the illusion of strong moves to the search tree, which is the reason for
@@ -504,7 +616,7 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
     // if eval comes from tt, is upper bounded and not higher that beta, we cant assume anything on score
     // evaluating is not worth it so we just skip
     // only do it if there are enough pieces to not avoid zugzwang blindness
-    if (!is_root && !is_pv && ss().pos->move() != Move::null() && !in_check && depth >= 3 && static_eval >= beta &&
+    if (!is_root && !is_pv && ss().move != Move::null() && !in_check && depth >= 3 && static_eval >= beta &&
         (!tt_hit || tt_hit->m_bound != UPPER || tt_hit->m_score > beta) && std::abs(static_eval) < MATE_IN_MAX_PLY &&
         pos.occupancy(KNIGHT, BISHOP, ROOK, QUEEN).popcount() >= 3) // add loss condition ?
     {
@@ -512,7 +624,7 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
         int null_depth = std::max((depth - 1) / 2, (depth - reduction - 1) / 2);
         do_move<false>(Move::null());
 
-        auto score = -Negamax(null_depth, -beta, -(beta - 1));
+        auto score = -Negamax<NonPv>(null_depth, -beta, -(beta - 1));
 
         undo_move<false>();
 
@@ -527,56 +639,29 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
     }
 
 
-    // generate all legal moves
-    MoveList moves = gen_legal(pos);
-
-    if (moves.empty())
-    {
-        return in_check ? mated_in(ply()) : 0;
-    }
-
-    // score the moves to sort them
-    if (is_root && depth > 7)
-    {
-        for (auto& [m, s] : moves)
-        {
-            s += m_root_refutation_time[m.raw()];
-            if (tt_hit && m == tt_hit->m_move)
-            {
-                s = std::numeric_limits<int>::max();
-            }
-        }
-
-    } else
-    {
-        score_moves(ss(), moves, tt_hit ? tt_hit->m_move : Move::none(), m_history, ss());
-    }
-    moves.sort();
+    const Move tt_move = tt_hit ? tt_hit->m_move : Move::none();
 
     // probcut, need to look at conditions and parameters more closely
     if (!is_root && !ss().excluded && !is_pv && !in_check && depth >= 3 && static_eval >= beta + 150)
     {
         int       prob_beta = beta + 150;
 
-        MoveList  tactical  = filter_tactical(pos, gen_legal(pos));
-        score_moves(ss(), tactical, tt_hit ? tt_hit->m_move : Move::none(), m_history, ss());
-        tactical.sort();
-
-        for (auto [m, s] : tactical)
+        MovePicker tactical{ss(), m_history};
+        while (const Move m = tactical.next())
         {
-            if (m == tt_hit->m_move || s < -1'000'000)
+            if (!pos.is_legal(m))
             {
                 continue;
             }
             do_move(m);
 
-            auto score = -QSearch(-prob_beta, -prob_beta + 1);
+            auto score = -QSearch<NonPv>(-prob_beta, -prob_beta + 1);
 
             if (score >= prob_beta)
             {
                 const int reduction  = 3;
                 int prob_depth = std::max(1, depth - 1 - reduction);
-                prob_beta = -Negamax(prob_depth, -beta, -beta + 1);
+                prob_beta = -Negamax<NonPv>(prob_depth, -beta, -beta + 1);
             }
 
 
@@ -589,6 +674,33 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
         }
     }
 
+    // the root still scores every move up front, everywhere else the picker generates them stage by stage
+    MoveList root_moves{};
+    if constexpr (is_root)
+    {
+        for (const auto& sm : m_root_moves)
+        {
+            if (!in_earlier_line(sm.move))
+                root_moves.push_back(sm);
+        }
+        if (depth > 7)
+        {
+            for (auto& [m, s] : root_moves)
+            {
+                s += m_root_refutation_time[m.raw()];
+                if (m == tt_move)
+                {
+                    s = std::numeric_limits<int>::max();
+                }
+            }
+        }
+        else
+        {
+            score_moves(ss(), root_moves, tt_move, m_history, ss());
+        }
+    }
+    MovePicker picker = is_root ? MovePicker{ss(), root_moves, m_history} : MovePicker{ss(), tt_move, m_history};
+
 
     int      best_eval   = -INF_SCORE;
     Move     local_best  = Move::none();
@@ -600,14 +712,30 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
 
     MoveList quiets{};
     MoveList captures{};
+    int      n_legal = 0;
 
     // Move loop
-    for (auto [m, s] : moves)
+    while (const Move m = picker.next(skip_quiets))
     {
+        // the picker only gives pseudo legal moves, moves after a cutoff or skipped with the quiets are never checked
+        if (!pos.is_legal(m))
+        {
+            continue;
+        }
+        n_legal++;
+
+        // a long root iteration says what it is on, kept quiet for the first seconds to not flood the gui
+        if constexpr (is_root)
+        {
+            if (m_thread_id == 0 && m_tm.elapsed_ms() > 3000)
+            {
+                std::cout << std::format("info depth {} currmove {} currmovenumber {}", depth, m.to_string(), n_legal)
+                          << std::endl;
+            }
+        }
 
         if (m == ss().excluded)
         {
-            assert(moves.size() > 1);
             continue;
         }
 
@@ -674,7 +802,7 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
                 }
 
                 // SEE pruning for quiets. Approximate of the rice implementation, need to change see computation
-                if (depth <= 8 && is_captured && pos.see(m) + 70 * depth <  0)
+                if (depth <= 8 && is_captured && !pos.see_ge(m, -70 * depth))
                 {
                     move_idx++;
                     first_move = false;
@@ -684,7 +812,7 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
             } else
             {
                 // SEE pruning but for noisy
-                if (depth <= 6 && is_captured && pos.see(m) + 15 * depth * depth <  0)
+                if (depth <= 6 && is_captured && !pos.see_ge(m, -15 * depth * depth))
                 {
                     move_idx++;
                     first_move = false;
@@ -703,20 +831,19 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
         bool allow_singular_extension = false;
         bool double_extend = false;
         bool negative_extension = false;
-        Move tt_move = tt_hit ? tt_hit->m_move : Move::none();
 
 
         // Extend the search if the move comes from TT.
         if (!is_root && !is_pv && depth >= 6 && tt_move != Move::none() &&
             tt_hit->m_bound == LOWER && tt_hit->m_depth >= depth - 3 &&
-            std::abs(read_tt_score(tt_hit->m_score, ply())) < MATE_IN_MAX_PLY && moves.size() > 1)
+            std::abs(read_tt_score(tt_hit->m_score, ply())) < MATE_IN_MAX_PLY)
         {
             int tt_score = read_tt_score(tt_hit->m_score, ply());
             int singular_beta = tt_score - depth;
             int singular_depth = (depth - 1) / 2;
 
             ss().excluded = tt_move;
-            int singular_score = Negamax(singular_depth, singular_beta - 1, singular_beta);
+            int singular_score = Negamax<NonPv>(singular_depth, singular_beta - 1, singular_beta);
             ss().excluded = Move::none();
 
             if (singular_score < singular_beta)
@@ -726,7 +853,7 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
                 if (singular_score < singular_beta - 20 && ss().double_extensions <= 5)
                 {
                     double_extend = true;
-                    ss().double_extensions = ss().prev() ? ss().prev()->double_extensions + 1 : 1;
+                    ss().double_extensions = ss().prev()->double_extensions + 1;
                 }
             }
             else if (tt_score >= beta)
@@ -778,7 +905,7 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
 
             assert(search_depth >0);
             // do the search at reduced depth (picking up from where the extensions left us)
-            score = -Negamax(search_depth - 1, -alpha -1, -alpha);
+            score = -Negamax<NonPv>(search_depth - 1, -alpha -1, -alpha);
             assert(score != -INF);
 
             // go full depth if score beat alpha
@@ -794,21 +921,21 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
         // Full depth null window
         if (fullsearch)
         {
-            score = -Negamax(search_depth-1, -alpha -1, -alpha);
+            score = -Negamax<NonPv>(search_depth-1, -alpha -1, -alpha);
             assert(score != -INF);
         }
 
         // PVS
         if (is_pv && (first_move || (score > alpha && score < beta)))
         {
-            score = -Negamax(search_depth-1, -beta, -alpha);
+            score = -Negamax<Pv>(search_depth-1, -beta, -alpha);
             assert(score != -INF);
         }
 
         undo_move();
 
         uint64_t end = m_infos.nodes;
-        if (is_root)
+        if constexpr (is_root)
         {
             m_root_refutation_time[m.raw()] += end - begin;
         }
@@ -826,7 +953,11 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
             local_best = m;
         }
         if (score > alpha)
+        {
             alpha = score;
+            if (is_pv)
+                ss().update_pv(m, m_ss[ply() + 1]);
+        }
 
         if (alpha >= beta)
         {
@@ -861,7 +992,13 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
         }
     }
 
-    if (m_thread_id == 0 && is_root)
+    // no legal move, or the excluded one was the only one and the singular search fails low
+    if (n_legal == 0 || (n_legal == 1 && ss().excluded))
+    {
+        return ss().excluded ? alpha : in_check ? mated_in(ply()) : 0;
+    }
+
+    if (is_root && m_thread_id == 0)
     {
         TimeManager::UpdateInfo info{};
         info.eval = absolute_eval(best_eval, pos.side_to_move());
@@ -877,31 +1014,33 @@ inline int SearchThread::Negamax(int depth, int alpha, int beta)
 
     assert(local_best != Move::none() && local_best != Move::null());
     bool best_valid = !m_tm.should_stop() && local_best != Move::none() && ss().excluded == Move::none();
-    if (is_root && best_valid)
+    if (is_root && best_valid && m_pv_idx == 0)
         bestMove = local_best;
 
     //std::cout << best_valid << " " << local_best << " " << best_eval << " " << evaluate() << std::endl;
 
     tt_bound_t bound = (best_eval <= alpha_org) ? bound = UPPER : (best_eval >= beta) ? LOWER : EXACT;
-    if (best_valid)
-        g_tt.store(pos.hash(), depth, store_tt_score(best_eval, ply()), bound, local_best);
+    // the root of a secondary line has its best moves left out, its result would only spoil the entry of the first
+    if (best_valid && !(is_root && m_pv_idx > 0))
+        g_tt.store(pos.hash(), depth, store_tt_score(best_eval, ply()), raw_static_eval, bound, local_best);
 
     assert(best_eval > -INF && best_eval < INF);
     return best_eval;
 }
 
-inline int SearchThread::QSearch(int alpha, int beta)
+template <SearchNode node>
+int SearchThread::QSearch(int alpha, int beta)
 {
+    static_assert(node != Root, "the root is never a quiescence node");
+    constexpr bool is_pv = node == Pv;
+
    // std::cout << "Qsearch" << std::endl;
-    if (m_thread_id == 0 && m_infos.nodes % 4096 == 0)
-    {
-        m_tm.update_time();
-    }
+    check_limits();
+    ss().clear_pv();
+    m_seldepth = std::max(m_seldepth, ply());
 
     m_infos.nodes++;
 
-    bool is_pv = beta - alpha > 1;
-
     const Position&  pos = m_positions.last();
 
     //assert((pos.checkers(WHITE) | pos.checkers(BLACK)) == Bitboard::empty());
@@ -927,14 +1066,12 @@ inline int SearchThread::QSearch(int alpha, int beta)
     }
 
     auto tt_hit = g_tt.probe(pos.hash());
-    if (tt_hit)
-    {
-        do_move<false>(tt_hit->m_move);
-        if (is_draw())
-            tt_hit = std::nullopt;
-        undo_move<false>();
-
-    }
+    // the key check only has 16 bits, an entry whose move can't be played here was stored by another position
+    if (tt_hit && !pos.is_pseudo_legal(tt_hit->m_move))
+        tt_hit = std::nullopt;
+    // an entry whose move repeats is not trusted, its score was found on another path
+    if (tt_hit && m_positions.is_repetition_after(tt_hit->m_move))
+        tt_hit = std::nullopt;
     if (!is_pv && tt_hit)
     {
         const tt_entry_t& e     = *tt_hit;
@@ -950,25 +1087,13 @@ inline int SearchThread::QSearch(int alpha, int beta)
     }
 
 
-    if (pos.occupancy().popcount() <= 7) {
-        auto wdl = pos.wdl_probe();
-        if (wdl != TB_RESULT_FAILED) {
-            m_infos.tb_hits++;
+    if (const auto tb_score = probe_wdl(0))
+        return *tb_score;
 
-            int score;
-            switch (wdl) {
-                case TB_LOSS: score = LOSS_TB + ply(); break;
-                case TB_DRAW: case TB_BLESSED_LOSS: case TB_CURSED_WIN: score = 0; break;
-                case TB_WIN:  score = WIN_TB - ply(); break;
-                default:          score = 0;
-            }
 
-            return score;
-        }
-    }
-
-
-    const int stand_pat = evaluate();
+    // an entry stored by a Negamax node in check has no eval
+    const int raw_stand_pat = tt_hit && !pos.checkers(pos.side_to_move()) ? tt_hit->m_eval : raw_eval();
+    const int stand_pat     = adjust_eval(raw_stand_pat);
     ss().eval = stand_pat;
 
     //assert(beta > -INF && beta < INF);
@@ -996,7 +1121,7 @@ inline int SearchThread::QSearch(int alpha, int beta)
 
         do_move(m);
 
-        const int score = -QSearch(-beta, -alpha);
+        const int score = -QSearch<node>(-beta, -alpha);
 
         undo_move();
 
@@ -1011,12 +1136,16 @@ inline int SearchThread::QSearch(int alpha, int beta)
             best_move = m;
         }
         if (best_eval > alpha)
+        {
             alpha = best_eval;
+            if (is_pv)
+                ss().update_pv(m, m_ss[ply() + 1]);
+        }
         if (alpha >= beta)
             break;
     }
     tt_bound_t bound = (best_eval >= beta) ? LOWER : UPPER;
-    if (best_move != Move::none())g_tt.store(pos.hash(), 0, store_tt_score(best_eval, ply()), bound, best_move);
+    if (best_move != Move::none())g_tt.store(pos.hash(), 0, store_tt_score(best_eval, ply()), raw_stand_pat, bound, best_move);
     assert(best_eval > -INF && best_eval < INF);
     return best_eval;
 }
@@ -1024,20 +1153,32 @@ inline int SearchThread::QSearch(int alpha, int beta)
 struct SearchThreadHandler
 {
     std::vector<std::unique_ptr<SearchThread>> threads{};
-    std::vector<std::jthread>                  workers{};
     TimeManager                                m_tm{};
 
-    void set(const size_t numThreads, const TimeManager& tm, const Position& pos, const std::span<Move> moves)
+    ~SearchThreadHandler() { resize(0); }
+
+    // the pool is only rebuilt when the thread count changes, otherwise the threads are re-seeded with the new root
+    void set(const size_t numThreads, const TimeManager& tm, const Position& pos, const std::span<Move> moves,
+             const size_t multipv = 1)
     {
-        threads.clear();
-        threads.reserve(numThreads);
-        workers.clear();
-        workers.reserve(threads.size());
         m_tm = tm;
-        for (size_t i = 0; i < numThreads; i++)
+        if (threads.size() != numThreads)
         {
-            threads.push_back(std::make_unique<SearchThread>(i, m_tm, pos, moves));
+            resize(numThreads, pos, moves);
+        }
+
+        // the root is probed once here, every thread then searches the same (possibly narrowed) move list
+        const Positions root{pos, moves};
+        MoveList        root_moves = gen_legal(root.last());
+        const bool      tb_root    = tb_filter_root_moves(root.last(), root.has_repeated(), root_moves);
+
+        for (const auto& thread : threads)
+        {
+            thread->set_root(pos, moves, root_moves, multipv);
+            thread->m_pool = threads;
         }
+        if (tb_root && !threads.empty())
+            threads.front()->m_infos.tb_hits++;
     }
 
     void start()
@@ -1046,44 +1187,142 @@ struct SearchThreadHandler
 
         m_tm.start();
 
-        for (const auto& thread : threads)
         {
-            workers.emplace_back([t = thread.get()]() { t->IterativeDeepening(); });
+            std::lock_guard lock(m_mutex);
+            m_running = threads.size();
+            ++m_search_id;
         }
+        m_start_cv.notify_all();
 
-        for (auto& w : workers)
-            if (w.joinable())
-                w.join();
+        {
+            std::unique_lock lock(m_mutex);
+            m_done_cv.wait(lock, [this]() { return m_running == 0; });
+        }
+
+        // a ponder or infinite search that ran out of depth still has to wait before answering
+        m_tm.wait_release();
 
         if (const auto move = get_best_move(); move != Move::none())
         {
             std::cout << "bestmove " << move << std::endl;
         }
+    }
 
-        threads.clear();
-        workers.clear();
-
+    // new game, the old histories would only mislead move ordering
+    void clear()
+    {
+        for (const auto& thread : threads)
+        {
+            thread->m_history.clear();
+        }
     }
 
+    // each thread votes for its move with a weight growing with the depth it completed and how much better its
+    // score is than the worst one, a proven mate wins outright
     [[nodiscard]] Move get_best_move() const
     {
-        std::unordered_map<uint16_t, int> move_votes;
+        if (threads.empty())
+            return Move::none();
 
+        // a thread that never finished an iteration has no move and a default score, it takes no part in the vote
+        auto has_move = [](const auto& t)
+        { return t->m_result.best_move != Move::none() && t->m_result.best_move != Move::null(); };
+
+        int min_score = std::numeric_limits<int>::max();
+        for (const auto& t : threads | std::views::filter(has_move))
+            min_score = std::min(min_score, t->m_result.score);
+
+        std::unordered_map<uint16_t, int64_t> move_votes;
         for (const auto& t : threads)
         {
-            move_votes[t->bestMove.raw()]++;
+            if (has_move(t))
+                move_votes[t->m_result.best_move.raw()] +=
+                    static_cast<int64_t>(t->m_result.score - min_score + 14) * std::max(t->m_result.depth, 1);
         }
 
-        const auto it =
-            std::ranges::max_element(move_votes, [](const auto& a, const auto& b) { return a.second < b.second; });
+        const SearchThread* best = threads.front().get();
+        for (const auto& t : threads)
+        {
+            const auto& r  = t->m_result;
+            const auto& br = best->m_result;
+            if (r.best_move == Move::none() || r.best_move == Move::null())
+                continue;
+            if (br.best_move == Move::none() || br.best_move == Move::null())
+            {
+                best = t.get();
+                continue;
+            }
+
+            if (r.score >= MATE_IN_MAX_PLY || br.score >= MATE_IN_MAX_PLY)
+            {
+                if (r.score > br.score)
+                    best = t.get();
+            }
+            else if (move_votes[r.best_move.raw()] > move_votes[br.best_move.raw()] ||
+                     (move_votes[r.best_move.raw()] == move_votes[br.best_move.raw()] && r.depth > br.depth))
+            {
+                best = t.get();
+            }
+        }
 
-        return it != move_votes.end() ? Move{it->first} : Move{};
+        return best->m_result.best_move;
     }
 
     void stop_all()
     {
         m_tm.stop();
+        m_tm.release();
+    }
+
+    void ponderhit() { m_tm.ponderhit(); }
+
+private:
+    void resize(const size_t numThreads, const Position& pos = {}, const std::span<Move> moves = {})
+    {
+        // jthreads request stop and join on destruction, the idle wait below wakes up on it
+        workers.clear();
+        threads.clear();
+
+        threads.reserve(numThreads);
+        workers.reserve(numThreads);
+        for (size_t i = 0; i < numThreads; i++)
+        {
+            threads.push_back(std::make_unique<SearchThread>(i, m_tm, pos, moves));
+        }
+        for (size_t i = 0; i < numThreads; i++)
+        {
+            workers.emplace_back([this, t = threads[i].get(), id = m_search_id](const std::stop_token& st)
+                                 { idle_loop(st, *t, id); });
+        }
+    }
+
+    void idle_loop(const std::stop_token& st, SearchThread& thread, uint64_t last_search)
+    {
+        while (true)
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                if (!m_start_cv.wait(lock, st, [&]() { return m_search_id != last_search; }))
+                    return;
+                last_search = m_search_id;
+            }
+
+            thread.IterativeDeepening();
+
+            std::lock_guard lock(m_mutex);
+            if (--m_running == 0)
+                m_done_cv.notify_all();
+        }
     }
+
+    std::mutex                  m_mutex{};
+    std::condition_variable_any m_start_cv{};
+    std::condition_variable     m_done_cv{};
+    uint64_t                    m_search_id{};
+    size_t                      m_running{};
+
+    // last member so the workers are joined before anything they use goes away
+    std::vector<std::jthread> workers{};
 };
 
 #endif // SEARCHER_H
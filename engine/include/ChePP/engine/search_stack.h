@@ -6,6 +6,8 @@
 #define CHEPP_SEARCH_STACK_H
 
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstddef>
 #include <memory>
@@ -17,7 +19,11 @@ public:
     class Node {
     public:
         // general infos
+        // the searched position, made and unmade in place so every node of a thread points to the same one
         Position* pos;
+        // the move that led to this node and the piece that made it
+        Move  move{Move::none()};
+        Piece moved{NO_PIECE};
         int ply{0};
         int eval{0};
         Move excluded{Move::none()};
@@ -27,46 +33,59 @@ public:
         Move killer1{Move::none()};
         Move killer2{Move::none()};
 
+        // triangular pv: the best line found from this node, emptied when the node is entered
+        std::array<Move, MAX_PLY + 1> pv{};
+        int pv_length{0};
 
+        void clear_pv() { pv_length = 0; }
 
-
-        [[nodiscard]] const Node* next() const {
-            if (const auto self = this; self + 1 < owner_end_) {
-                return self + 1;
-            }
-            return nullptr;
+        void update_pv(const Move m, const Node& child)
+        {
+            pv[0] = m;
+            std::copy_n(child.pv.begin(), child.pv_length, pv.begin() + 1);
+            pv_length = child.pv_length + 1;
         }
 
-        [[nodiscard]] const Node* prev() const {
-            if (const auto self = this; self > owner_begin_) {
-                return self - 1;
-            }
-            return nullptr;
-        }
 
 
-    private:
-        friend class SearchStack;
-        inline static Node* owner_begin_{nullptr};
-        inline static Node* owner_end_{nullptr};
+
+        // the stack is padded with sentinels before ply 0, so looking back a few plies never leaves it
+        [[nodiscard]] const Node* next() const { return this + 1; }
+        [[nodiscard]] const Node* prev(const int n = 1) const { return this - n; }
     };
 
+    // plies before ply 0, enough for the deepest look back of the search (ss - 4 for the improving heuristic)
+    static constexpr std::size_t SENTINELS = 4;
+
     explicit SearchStack(const std::size_t depth)
         : capacity_(depth),
-          nodes_(std::make_unique<Node[]>(depth))
+          nodes_(std::make_unique<Node[]>(depth + SENTINELS))
     {
-        Node::owner_begin_ = nodes_.get();
-        Node::owner_end_   = nodes_.get() + depth;
+        clear();
+    }
+
+    // back to freshly constructed nodes, used when a search thread is re-seeded
+    void clear()
+    {
+        for (std::size_t i = 0; i < capacity_ + SENTINELS; i++)
+        {
+            nodes_[i] = Node{};
+        }
+        // sentinels have no move, so no continuation history, and an eval no node can beat so they count as improving
+        for (std::size_t i = 0; i < SENTINELS; i++)
+        {
+            nodes_[i].eval = INF;
+        }
     }
 
     Node& operator[](std::size_t i) {
         assert(i < capacity_);
-        return nodes_[i];
+        return nodes_[i + SENTINELS];
     }
 
     const Node& operator[](const std::size_t i) const {
         assert(i < capacity_);
-        return nodes_[i];
+        return nodes_[i + SENTINELS];
     }
 
     [[nodiscard]] std::size_t capacity() const { return capacity_; }
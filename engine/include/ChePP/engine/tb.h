@@ -5,10 +5,29 @@
 #ifndef TB_H
 #define TB_H
 
+#include "movegen.h"
+#include "position.h"
+
 #include <src/tbprobe.h>
 
+#include <algorithm>
+#include <array>
 #include <filesystem>
 #include <iostream>
+#include <memory>
+
+// set from the Syzygy uci options. Probes need at most probe_limit pieces, and a remaining depth of at least
+// probe_depth unless there are strictly fewer pieces than the limit
+struct TbParams
+{
+    int probe_depth{1};
+    int probe_limit{7};
+};
+
+inline TbParams g_tb_params{};
+
+// bumped every time tables are loaded, cached probe results are only good for the tables they came from
+inline uint64_t g_tb_generation{};
 
 inline bool init_tb(const std::string_view path)
 {
@@ -19,6 +38,7 @@ inline bool init_tb(const std::string_view path)
 
     if (tb_init(path.begin()))
     {
+        ++g_tb_generation;
         return true;
     }
     std::cerr << "Tablebase init failed: " << path << "\n";
@@ -26,4 +46,96 @@ inline bool init_tb(const std::string_view path)
 
 }
 
+inline unsigned tb_promotes(const Move move)
+{
+    if (move.type_of() != PROMOTION)
+        return TB_PROMOTES_NONE;
+    switch (move.promotion_type().value())
+    {
+        case (QUEEN).value(): return TB_PROMOTES_QUEEN;
+        case (ROOK).value(): return TB_PROMOTES_ROOK;
+        case (BISHOP).value(): return TB_PROMOTES_BISHOP;
+        default: return TB_PROMOTES_KNIGHT;
+    }
+}
+
+// Narrows the legal root moves down to the ones keeping the best tablebase result. Fathom ranks them by DTZ when
+// the DTZ tables are there, by WDL alone otherwise. Moves are left alone when the root is not in the tables.
+inline bool tb_filter_root_moves(const Position& pos, const bool has_repeated, MoveList& moves)
+{
+    if (moves.empty() || pos.occupancy().popcount() > static_cast<int>(TB_LARGEST) || pos.castling_rights().mask())
+        return false;
+
+    // too big for the stack of the uci thread
+    const auto results = std::make_unique<TbRootMoves>();
+    if (!pos.root_dtz_probe(*results, has_repeated) && !pos.root_wdl_probe(*results))
+        return false;
+    if (results->size == 0)
+        return false;
+
+    const std::span probed{results->moves, results->size};
+    const int32_t best_rank = std::ranges::max(probed, {}, &TbRootMove::tbRank).tbRank;
+
+    MoveList kept{};
+    for (const auto& [move, score] : moves)
+    {
+        const auto it = std::ranges::find_if(probed, [&](const TbRootMove& r) {
+            return TB_MOVE_FROM(r.move) == move.from_sq().index() && TB_MOVE_TO(r.move) == move.to_sq().index() &&
+                   TB_MOVE_PROMOTES(r.move) == tb_promotes(move);
+        });
+        if (it != probed.end() && it->tbRank == best_rank)
+            kept.push_back(move);
+    }
+
+    if (kept.empty())
+        return false;
+
+    moves = kept;
+    return true;
+}
+
+// Per thread cache of WDL probes. The same few endgames come back all over the tree (qsearch included) and
+// a probe may go to disk, so results are kept by position hash, failed ones too.
+class WdlCache
+{
+  public:
+    [[nodiscard]] static bool should_probe(const Position& pos, const int depth)
+    {
+        const int pieces = pos.occupancy().popcount();
+        const int limit  = std::min(g_tb_params.probe_limit, static_cast<int>(TB_LARGEST));
+        // fathom only answers WDL probes right after a zeroing move and without castling rights
+        return pieces <= limit && (pieces < limit || depth >= g_tb_params.probe_depth) && pos.halfmove_clock() == 0 &&
+               !pos.castling_rights().mask();
+    }
+
+    unsigned probe(const Position& pos)
+    {
+        if (m_generation != g_tb_generation)
+        {
+            m_entries.fill({});
+            m_generation = g_tb_generation;
+        }
+
+        Entry& e = m_entries[pos.hash() & (N_ENTRIES - 1)];
+        if (e.key != pos.hash() || !e.valid)
+        {
+            e = Entry{pos.hash(), pos.wdl_probe(), true};
+        }
+        return e.wdl;
+    }
+
+  private:
+    struct Entry
+    {
+        hash_t   key{};
+        unsigned wdl{};
+        bool     valid{};
+    };
+
+    static constexpr size_t N_ENTRIES = 1 << 13;
+
+    std::array<Entry, N_ENTRIES> m_entries{};
+    uint64_t                     m_generation{};
+};
+
 #endif //TB_H
@@ -4,6 +4,7 @@
 #include "types.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
@@ -85,6 +86,9 @@ struct TimeManager {
         EnumArray<Color, int> inc{-1, -1};
         int moves_to_go{-1};
         int depth = 99;
+        uint64_t nodes{0};
+        bool infinite{false};
+        bool ponder{false};
     };
 
     struct Params {
@@ -114,18 +118,38 @@ struct TimeManager {
     TimeManager() = default;
 
     explicit TimeManager(const Params& params, InitInfo info, const Constraints& constraints)
-        : params(params), init_info(std::move(info)), constraints(constraints), update_infos(params.sampling_depth) {
+        : params(params), init_info(std::move(info)), constraints(constraints), update_infos(params.sampling_depth),
+          m_hold(constraints.infinite || constraints.ponder) {
         compute_base_time();
     }
 
+    // the atomic stop flag is not copyable, copy its current value instead
+    TimeManager(const TimeManager& other) { *this = other; }
+
+    TimeManager& operator=(const TimeManager& other)
+    {
+        params           = other.params;
+        init_info        = other.init_info;
+        constraints      = other.constraints;
+        update_infos     = other.update_infos;
+        start_time       = other.start_time;
+        m_max_time_ms    = other.m_max_time_ms;
+        adjusted_time_ms = other.adjusted_time_ms;
+        m_stop_flag      = other.m_stop_flag.load();
+        m_hold           = other.m_hold.load();
+        m_ponderhit      = other.m_ponderhit.load();
+        return *this;
+    }
+
+    // the flags come fresh with each go, resetting them here could eat a stop sent right after it
     void start() {
         start_time = std::chrono::steady_clock::now();
-        m_stop_flag = false;
     }
 
+    // polled by every search thread, only the main thread checks the clock and raises it
     bool should_stop() const
     {
-        return m_stop_flag;
+        return m_stop_flag.load(std::memory_order_relaxed);
     }
 
     void send_update_info(const UpdateInfo& info)
@@ -134,15 +158,32 @@ struct TimeManager {
         //adjust_time();
     }
 
+    [[nodiscard]] bool depth_exceeded(const int depth) const
+    {
+        return depth > 0 && constraints.depth > 0 && depth > constraints.depth;
+    }
+
+    [[nodiscard]] int64_t elapsed_ms() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time)
+            .count();
+    }
+
+    // 0 when the search is not node limited
+    [[nodiscard]] uint64_t node_limit() const { return constraints.nodes; }
+
     void update_depth(const int depth)
     {
         //std::cout << adjusted_time_ms << " " << depth << std::endl;
-        if (depth > 0 && constraints.depth > 0 && depth > constraints.depth) {
+        if (depth_exceeded(depth)) {
             m_stop_flag = true;
         }
     }
 
     void update_time() {
+        if (m_hold) return;
+
+        // the clock only started for us when the ponder move was played
+        if (m_ponderhit.exchange(false)) start_time = std::chrono::steady_clock::now();
 
         if (m_max_time_ms > 0) {
             auto elapsed = std::chrono::steady_clock::now() - start_time;
@@ -154,6 +195,23 @@ struct TimeManager {
 
     void stop() { m_stop_flag = true; }
 
+    // go infinite and go ponder: the clock is ignored and the bestmove waits for stop, or for ponderhit which turns
+    // a ponder search into a normal timed one
+    [[nodiscard]] bool on_hold() const { return m_hold; }
+
+    void release() {
+        m_hold = false;
+        m_hold.notify_all();
+    }
+
+    void wait_release() const { m_hold.wait(true); }
+
+    void ponderhit() {
+        if (!constraints.ponder || constraints.infinite) return;
+        m_ponderhit = true;
+        release();
+    }
+
 private:
 
     [[nodiscard]] int estimate_moves_to_go() const {
@@ -266,7 +324,9 @@ private:
     std::chrono::steady_clock::time_point start_time{};
     int m_max_time_ms{-1};
     int adjusted_time_ms{-1};
-    bool m_stop_flag{false};
+    std::atomic<bool> m_stop_flag{false};
+    std::atomic<bool> m_hold{false};
+    std::atomic<bool> m_ponderhit{false};
 };
 
 #endif // TIME_MANAGER_H
@@ -7,9 +7,14 @@
 
 #include "types.h"
 
-#include <bits/shared_ptr_base.h>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <thread>
 #include <vector>
+#include "ChePP/engine/large_pages.h"
 #include "ChePP/engine/zobrist.h"
 
 enum tt_bound_t : uint8_t {
@@ -18,24 +23,68 @@ enum tt_bound_t : uint8_t {
     UPPER,
 };
 
+// Decoded entry, what a probe hands back to the search
 struct tt_entry_t
 {
+    static constexpr int GENERATION_BITS = 6;
+    static constexpr int GENERATION_MASK = (1 << GENERATION_BITS) - 1;
 
     tt_entry_t() noexcept = default;
-    tt_entry_t(const hash_t hash, const int depth, const int score, const tt_bound_t bound, const int generation, const Move move)
-        : m_hash(hash), m_depth(depth), m_score(static_cast<int16_t>(score)), m_move(move), m_bound(bound), m_generation(generation)
+    tt_entry_t(const int depth, const int score, const int eval, const tt_bound_t bound, const int generation,
+               const Move move)
+        : m_depth(static_cast<uint8_t>(std::clamp(depth, 0, 255))), m_bound(bound),
+          m_generation(static_cast<uint8_t>(generation & GENERATION_MASK)), m_move(move),
+          m_score(static_cast<int16_t>(score)), m_eval(static_cast<int16_t>(eval))
     {
     }
 
-    hash_t  m_hash{};
-    uint16_t m_depth{};
-    int16_t m_score{};
-    Move m_move{};
+    // the whole entry fits in one word so it can be written and read with a single atomic access
+    // layout: move 0-15, score 16-31, eval 32-47, depth 48-55, bound 56-57, generation 58-63
+    [[nodiscard]] uint64_t pack() const
+    {
+        return static_cast<uint64_t>(m_move.raw()) | static_cast<uint64_t>(static_cast<uint16_t>(m_score)) << 16 |
+               static_cast<uint64_t>(static_cast<uint16_t>(m_eval)) << 32 | static_cast<uint64_t>(m_depth) << 48 |
+               static_cast<uint64_t>(m_bound) << 56 | static_cast<uint64_t>(m_generation) << 58;
+    }
+
+    static tt_entry_t unpack(const uint64_t data)
+    {
+        tt_entry_t e;
+        e.m_move       = Move{static_cast<uint16_t>(data)};
+        e.m_score      = static_cast<int16_t>(data >> 16);
+        e.m_eval       = static_cast<int16_t>(data >> 32);
+        e.m_depth      = static_cast<uint8_t>(data >> 48);
+        e.m_bound      = static_cast<tt_bound_t>((data >> 56) & 0b11);
+        e.m_generation = static_cast<uint8_t>(data >> 58);
+        return e;
+    }
+
+    // how many generations ago the entry was written, generations wrap around
+    [[nodiscard]] int age(const int generation) const { return (generation - m_generation) & GENERATION_MASK; }
+
+    uint8_t    m_depth{};
     tt_bound_t m_bound{};
-    uint8_t m_generation{};
-    uint8_t m_repetitions{0};
+    uint8_t    m_generation{};
+    Move       m_move{};
+    int16_t    m_score{};
+    int16_t    m_eval{};
+};
+
+// One bucket fills exactly one cache line so a probe (and a prefetch) never touches more than one line.
+// The table is shared by every search thread without locks. Each slot is a packed data word and a 16-bit key check
+// which is the upper bits of the hash xored with the folded data. Both are written with relaxed atomics, a reader
+// that sees the key of one write and the data of another one gets a key mismatch and treats the slot as a miss.
+struct alignas(64) tt_bucket_t
+{
+    static constexpr size_t n_entries = 6;
+
+    std::array<std::atomic<uint64_t>, n_entries> m_data{};
+    std::array<std::atomic<uint16_t>, n_entries> m_keys{};
 };
 
+static_assert(sizeof(tt_bucket_t) == 64);
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint16_t>::is_always_lock_free);
+
 
 inline uint64_t floor_power_of_two(const uint64_t x) {
     if (x == 0) return 0;
@@ -45,18 +94,42 @@ inline uint64_t floor_power_of_two(const uint64_t x) {
 struct tt_t
 {
 
-    void init (const size_t mb)
+    // resizes the table to the largest power of two number of buckets that fits in mb megabytes
+    void init (const size_t mb, const size_t threads = 1)
     {
-        m_size = floor_power_of_two(mb * 1024 * 1024 / sizeof(tt_entry_t));
-        m_table.resize(m_size);
-        std::ranges::fill(m_table, tt_entry_t());
+        const size_t size = floor_power_of_two(std::max<size_t>(mb, 1) * 1024 * 1024 / sizeof(tt_bucket_t));
+        if (size != m_size)
+        {
+            m_table.reset();
+            m_table = allocate_large_pages<tt_bucket_t>(size);
+            m_size  = size;
+        }
+        reset(threads);
     }
 
-    void reset()
+    // zeroing tens of gigabytes is slow, split it across the search threads.
+    // Since each thread is the first to touch its chunk, the pages also get spread over the NUMA nodes
+    void reset(const size_t threads = 1)
     {
-        std::ranges::fill(m_table, tt_entry_t());
+        const size_t n_threads = std::clamp<size_t>(threads, 1, m_size);
+        const size_t chunk     = (m_size + n_threads - 1) / n_threads;
+
+        std::vector<std::jthread> workers;
+        workers.reserve(n_threads);
+        for (size_t t = 0; t < n_threads; t++)
+        {
+            workers.emplace_back(
+                [this, t, chunk]()
+                {
+                    const size_t begin = std::min(t * chunk, m_size);
+                    const size_t end   = std::min(begin + chunk, m_size);
+                    std::uninitialized_value_construct(m_table.get() + begin, m_table.get() + end);
+                });
+        }
     }
 
+    [[nodiscard]] size_t size_mb() const { return m_size * sizeof(tt_bucket_t) / (1024 * 1024); }
+
     void prefetch(hash_t hash) const noexcept {
         const size_t idx = index(hash);
         __builtin_prefetch(&m_table[idx], 0, 3);
@@ -64,30 +137,78 @@ struct tt_t
 
     [[nodiscard]] std::optional<tt_entry_t> probe(const hash_t hash) const
     {
+        const uint16_t     key    = key_of(hash);
+        const tt_bucket_t& bucket = m_table[index(hash)];
+        for (size_t i = 0; i < tt_bucket_t::n_entries; i++)
+        {
+            const uint64_t data = bucket.m_data[i].load(std::memory_order_relaxed);
+            if (data != 0 && (bucket.m_keys[i].load(std::memory_order_relaxed) ^ fold(data)) == key)
+            {
+                return tt_entry_t::unpack(data);
+            }
+        }
+        return std::nullopt;
+    }
 
-        const tt_entry_t& cur = m_table[index(hash)];
-        if (cur.m_hash != hash)
+    void store(const hash_t hash, const int depth, const int score, const int eval, tt_bound_t bound, const Move move)
+    {
+        const uint16_t key    = key_of(hash);
+        tt_bucket_t&   bucket = m_table[index(hash)];
+
+        // an entry for the same position is always the one updated, otherwise the least valuable slot is evicted
+        size_t     replace      = 0;
+        int        replace_val  = std::numeric_limits<int>::max();
+        bool       same         = false;
+        tt_entry_t cur{};
+        for (size_t i = 0; i < tt_bucket_t::n_entries; i++)
         {
-            return std::nullopt;
+            const uint64_t data  = bucket.m_data[i].load(std::memory_order_relaxed);
+            const tt_entry_t e   = tt_entry_t::unpack(data);
+            if (data != 0 && (bucket.m_keys[i].load(std::memory_order_relaxed) ^ fold(data)) == key)
+            {
+                replace = i;
+                same    = true;
+                cur     = e;
+                break;
+            }
+            if (const int v = data == 0 ? std::numeric_limits<int>::min() : value(e); v < replace_val)
+            {
+                replace     = i;
+                replace_val = v;
+            }
+        }
+
+        bool replace_ok = !same || cur.m_depth <= depth || cur.age(m_generation) != 0 ||
+            (cur.m_bound != EXACT && bound == EXACT);
+        if (replace_ok) {
+            const uint64_t data = tt_entry_t(depth, score, eval, bound, m_generation, move).pack();
+            bucket.m_data[replace].store(data, std::memory_order_relaxed);
+            bucket.m_keys[replace].store(key ^ fold(data), std::memory_order_relaxed);
         }
-        return cur;
     }
 
-    void store(const hash_t hash, const int depth, const int score, tt_bound_t bound, const Move move)
+    // permille of the first thousand slots holding an entry of the current search, the uci hashfull
+    [[nodiscard]] int hashfull() const
     {
-        const tt_entry_t& cur = m_table[index(hash)];
-        const auto  entry = tt_entry_t(hash , depth, score, bound, m_generation, move);
-        bool replace = cur.m_depth <= depth  || cur.m_generation != m_generation ||
-            (cur.m_bound != EXACT && bound == EXACT) || cur.m_hash != hash;
-        if (replace) {
-            //if (cur.m_bound == EXACT) return;
-            m_table[index(hash)] = entry;
+        const size_t n_buckets = std::min<size_t>(1000 / tt_bucket_t::n_entries, m_size);
+        if (n_buckets == 0)
+            return 0;
+
+        size_t used = 0;
+        for (size_t b = 0; b < n_buckets; b++)
+        {
+            for (const auto& slot : m_table[b].m_data)
+            {
+                const uint64_t data = slot.load(std::memory_order_relaxed);
+                used += data != 0 && tt_entry_t::unpack(data).age(m_generation) == 0;
+            }
         }
+        return static_cast<int>(used * 1000 / (n_buckets * tt_bucket_t::n_entries));
     }
 
     void new_generation()
     {
-        m_generation++;
+        m_generation = (m_generation + 1) & tt_entry_t::GENERATION_MASK;
     }
 
 private:
@@ -97,9 +218,26 @@ private:
 
     }
 
+    // the index uses the lower bits, the key check uses the upper ones
+    [[nodiscard]] static uint16_t key_of(const hash_t hash)
+    {
+        return static_cast<uint16_t>(hash >> 48);
+    }
+
+    [[nodiscard]] static uint16_t fold(const uint64_t data)
+    {
+        return static_cast<uint16_t>(data ^ data >> 16 ^ data >> 32 ^ data >> 48);
+    }
+
+    // replacement priority inside a bucket, shallow and old entries go first
+    [[nodiscard]] int value(const tt_entry_t& e) const
+    {
+        return e.m_depth - 8 * e.age(m_generation);
+    }
+
     int m_generation = 0;
     std::size_t m_size = 0;
-    std::vector<tt_entry_t> m_table;
+    LargePageArray<tt_bucket_t> m_table;
 
 };
 
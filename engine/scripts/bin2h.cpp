@@ -123,6 +123,7 @@ int main(int argc,char**argv){
         parser.add_argument("--config").required().help("JSON config file");
         parser.add_argument("--header").required().help("Output header file");
         parser.add_argument("--cpp").required().help("Output cpp file");
+        parser.add_argument("--net").default_value(std::string{}).help("Optional versioned network file for EvalFile");
 
         try {
             parser.parse_args(argc, argv);
@@ -136,6 +137,7 @@ int main(int argc,char**argv){
         fs::path cfg_file = parser.get("--config");
         header_file = parser.get("--header");
         cpp_file = parser.get("--cpp");
+        fs::path net_file = parser.get("--net");
 
         std::ifstream raw(raw_file, std::ios::binary);
         if(!raw) throw std::runtime_error("Failed to open raw file: " + raw_file.string());
@@ -152,12 +154,37 @@ int main(int argc,char**argv){
         cpp << "#include " << absolute(header_file) << "\n\n";
 
         std::vector<std::unique_ptr<LayerBase>> layers;
+        std::vector<LayerType> types;
         for(const auto& entry : j){
             std::string type_str = entry.at("type");
             uint64_t size = entry.at("size");
             std::string name = entry.at("name");
             LayerType t = parse_type(type_str);
             layers.push_back(make_layer(t,size,name));
+            types.push_back(t);
+        }
+
+        // versioned network file, see network.h for the layout
+        std::ofstream net;
+        if (!net_file.empty()) {
+            net.open(net_file, std::ios::binary | std::ofstream::trunc);
+            if(!net) throw std::runtime_error("Failed to open network file: " + net_file.string());
+
+            char header[64] = {'C', 'h', 'e', 'P', 'P', 'n', 'e', 't'};
+            const uint32_t version = 1;
+            const auto n_layers = static_cast<uint32_t>(layers.size());
+            std::memcpy(header + 8, &version, sizeof(version));
+            std::memcpy(header + 12, &n_layers, sizeof(n_layers));
+            net.write(header, sizeof(header));
+
+            for(size_t i = 0; i < layers.size(); i++){
+                char entry[64] = {};
+                entry[0] = static_cast<char>(types[i]);
+                std::memcpy(entry + 8, &layers[i]->size, sizeof(uint64_t));
+                if(layers[i]->name.size() >= 48) throw std::runtime_error("Layer name too long: " + layers[i]->name);
+                std::memcpy(entry + 16, layers[i]->name.data(), layers[i]->name.size());
+                net.write(entry, sizeof(entry));
+            }
         }
 
         size_t total_size = 0;
@@ -174,6 +201,14 @@ int main(int argc,char**argv){
             }
 
             layer->emit_definition(cpp, buf.data());
+
+            if (net.is_open()) {
+                // every layer starts on a 64 byte boundary so the engine can use aligned loads on the mapping
+                const auto pos = static_cast<size_t>(net.tellp());
+                const std::vector<char> pad((64 - pos % 64) % 64, 0);
+                net.write(pad.data(), static_cast<std::streamsize>(pad.size()));
+                net.write(reinterpret_cast<const char*>(buf.data()), static_cast<std::streamsize>(bytes));
+            }
         }
 
         if (raw.tellg() != fs::file_size(raw_file.string()))
@@ -182,6 +217,7 @@ int main(int argc,char**argv){
         }
 
         std::cout<<"Embedded all layers into "<<header_file<<" and "<<cpp_file<<"\n";
+        if (net.is_open()) std::cout<<"Wrote versioned network "<<net_file<<"\n";
         return 0;
     } catch(const std::exception& e){
         std::cerr<<"Error: "<<e.what()<<"\n";
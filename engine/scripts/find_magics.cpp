@@ -0,0 +1,70 @@
+// Searches the fixed magics used by bitboard.h when pext is not available, prints them as C++ arrays.
+// The seed is fixed so the output is reproducible:
+//   g++ -std=c++23 -O2 -I../include find_magics.cpp -o find_magics && ./find_magics
+#include <ChePP/engine/bitboard.h>
+
+#include <bit>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <random>
+#include <vector>
+
+template <PieceType pc>
+uint64_t find_magic(const Square sq, std::mt19937_64& gen)
+{
+    const Bitboard mask{relevancy_mask<pc>(sq)};
+    const int      nb_ones{mask.popcount()};
+    const int      combinations{1 << nb_ones};
+    const int      shift{64 - nb_ones};
+
+    std::vector<Bitboard> blockers(combinations);
+    std::vector<Bitboard> attacks(combinations);
+    for (int comb = 0; comb < combinations; comb++)
+    {
+        blockers[comb] = mask_nb(mask, comb);
+        attacks[comb]  = ray<pc>(sq, blockers[comb]);
+    }
+
+    std::vector<Bitboard> table(combinations);
+    std::vector<int>      seen(combinations, 0);
+    for (int tries = 1;; tries++)
+    {
+        // sparse candidates work much better
+        const uint64_t magic = gen() & gen() & gen();
+        if (std::popcount((mask.value() * magic) >> 56) < 6)
+            continue;
+
+        bool fail = false;
+        for (int c = 0; c < combinations && !fail; c++)
+        {
+            const auto index = (blockers[c].value() * magic) >> shift;
+            if (seen[index] == tries && table[index] != attacks[c])
+                fail = true;
+            table[index] = attacks[c];
+            seen[index]  = tries;
+        }
+
+        if (!fail)
+            return magic;
+    }
+}
+
+template <PieceType pc>
+void print_magics(const char* name, std::mt19937_64& gen)
+{
+    std::cout << std::format("inline constexpr std::array<Bitboard::U64, 64> {}{{\n", name);
+    for (auto sq = A1; sq <= H8; ++sq)
+    {
+        std::cout << std::format("{}0x{:016X}ULL,{}", sq.value() % 4 == 0 ? "    " : " ", find_magic<pc>(sq, gen),
+                                 sq.value() % 4 == 3 ? "\n" : "");
+    }
+    std::cout << "};\n";
+}
+
+int main()
+{
+    std::mt19937_64 gen{0xC4E77};
+    print_magics<BISHOP>("g_bishop_magics", gen);
+    print_magics<ROOK>("g_rook_magics", gen);
+}
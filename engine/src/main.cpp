@@ -69,8 +69,6 @@ void print_accumulator(accumulator_t<nnue_t::s_accumulator_size>& acc, color_t c
 
 
 int main() {
-    g_tt.init(512);
-
     UCIEngine engine{};
     engine.loop();
 